@@ -7,7 +7,16 @@
 		'target_name': 'native_stuff',
 		'sources': [
 			'native/dtls.cpp',
+			'native/dtls_pool.cpp',
 			'native/srtp.cpp',
+			'native/evp_srtp.cpp',
+			'native/rtcp.cpp',
+			'native/sdp.cpp',
+			'native/timer_wheel.cpp',
+			'native/delay_line.cpp',
+			'native/send_queue.cpp',
+			'native/load.cpp',
+			'native/self_test.cpp',
 			'native/helper.cpp',
 		'native/module.cpp'
 			],
@@ -0,0 +1,394 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "delay_line.h"
+
+#include <cstring>
+
+#include <node_buffer.h>
+
+#include "srtp.h"
+#include "self_test.h"
+#include "helper.h"
+
+// released packets beyond this are freed instead of kept for reuse
+const size_t POOL_MAX_AVAILABLE = 256;
+
+const int DEFAULT_MAX_PACKETS = 1024;
+
+using namespace v8;
+
+v8::Persistent<v8::Function> DelayLine::constructor;
+
+// packet pool
+
+PacketPool& PacketPool::instance() {
+	static PacketPool pool;
+	return pool;
+}
+
+PacketPool::PacketPool() : _free(NULL), _allocated(0), _available(0) {
+}
+
+DelayedPacket* PacketPool::acquire() {
+	DelayedPacket *packet = _free;
+
+	if(packet) {
+		_free = packet->next;
+		--_available;
+	} else {
+		packet = new DelayedPacket;
+		++_allocated;
+	}
+
+	packet->next = NULL;
+
+	return packet;
+}
+
+void PacketPool::release(DelayedPacket *packet) {
+	if(_available >= POOL_MAX_AVAILABLE) {
+		delete packet;
+		--_allocated;
+		return;
+	}
+
+	packet->next = _free;
+	_free = packet;
+	++_available;
+}
+
+void PacketPool::trim() {
+	while(_free) {
+		DelayedPacket *packet = _free;
+		_free = packet->next;
+
+		delete packet;
+		--_allocated;
+	}
+
+	_available = 0;
+}
+
+// instantiation
+
+DelayLine::DelayLine(Srtp *srtp, int delay, int max_packets) :
+	_srtp(srtp), _delay(delay), _maxPackets(max_packets),
+	_head(NULL), _tail(NULL), _entry(DelayLine::expired, this),
+	_count(0), _dropped(0), _sent(0), _retained(false), _closed(false)
+{
+}
+
+DelayLine::~DelayLine() {
+	DEBUG("delay line destroyed");
+
+	clear();
+	_srtpHandle.Dispose();
+}
+
+void DelayLine::init(v8::Handle<v8::Object> exports) {
+	// Prepare constructor template
+	Local<FunctionTemplate> tpl = FunctionTemplate::New(New);
+	tpl->SetClassName(String::NewSymbol("DelayLine"));
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+	// protoype
+	NODE_SET_PROTOTYPE_METHOD(tpl, "rtp", rtp);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "rtcp", rtcp);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "close", close);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "stats", stats);
+	constructor = Persistent<Function>::New(tpl->GetFunction());
+	// static
+	constructor->Set(String::NewSymbol("poolStats"), FunctionTemplate::New(poolStats)->GetFunction());
+	constructor->Set(String::NewSymbol("trimPool"), FunctionTemplate::New(trimPool)->GetFunction());
+	constructor->Set(String::NewSymbol("selfTest"), FunctionTemplate::New(selfTest)->GetFunction());
+	// export
+	exports->Set(String::NewSymbol("DelayLine"), constructor);
+}
+
+v8::Handle<v8::Value> DelayLine::New(const v8::Arguments& args) {
+	HandleScope scope;
+
+	if (args.IsConstructCall()) {
+		// Invoked as constructor: `new MyObject(...)`
+		if(!Srtp::HasInstance(args[0])) {
+			return ThrowException(Exception::TypeError(String::New("Expected srtp session")));
+		}
+
+		if(!args[1]->IsNumber() || args[1]->Int32Value() < 0) {
+			return ThrowException(Exception::TypeError(String::New("Expected delay in milliseconds")));
+		}
+
+		Local<Object> srtp_obj = args[0]->ToObject();
+		Srtp *srtp = node::ObjectWrap::Unwrap<Srtp>(srtp_obj);
+
+		int delay = args[1]->Int32Value();
+		int max_packets = args[2]->IsNumber() ? args[2]->Int32Value() : DEFAULT_MAX_PACKETS;
+
+		DelayLine* obj = new DelayLine(srtp, delay, max_packets);
+		obj->_srtpHandle = Persistent<Object>::New(srtp_obj);
+		obj->Wrap(args.This());
+
+		return args.This();
+	} else {
+		// Invoked as plain function `MyObject(...)`, turn into construct call.
+		const int argc = 3;
+		Local<Value> argv[argc] = { args[0], args[1], args[2] };
+		return scope.Close(constructor->NewInstance(argc, argv));
+	}
+}
+
+// do stuff
+
+void DelayLine::schedule() {
+	if(!_head || _entry.list) {
+		return;
+	}
+
+	uint64_t now = uv_now(uv_default_loop());
+	uint64_t delay = _head->due > now ? _head->due - now : 0;
+
+	TimerWheel::instance().add(&_entry, delay);
+}
+
+void DelayLine::expired(TimerEntry *entry) {
+	DelayLine *line = (DelayLine*) entry->data;
+	uint64_t now = uv_now(uv_default_loop());
+
+	// keep us alive while calling into javascript
+	line->Ref();
+
+	while(line->_head && line->_head->due <= now && !line->_closed) {
+		DelayedPacket *batch[DELAY_BATCH];
+		size_t count = 0;
+
+		while(count < DELAY_BATCH && line->_head && line->_head->due <= now) {
+			DelayedPacket *packet = line->_head;
+
+			line->_head = packet->next;
+
+			if(!line->_head) {
+				line->_tail = NULL;
+			}
+
+			--line->_count;
+
+			batch[count++] = packet;
+		}
+
+		line->send(batch, count);
+
+		for(size_t i = 0; i < count; ++i) {
+			PacketPool::instance().release(batch[i]);
+		}
+	}
+
+	line->schedule();
+	line->release();
+
+	line->Unref();
+}
+
+void DelayLine::send(DelayedPacket **batch, size_t count) {
+	HandleScope scope;
+
+	// protect rtp and rtcp in one go each, the order is kept when emitting
+
+	SrtpPacket rtp[DELAY_BATCH];
+	SrtpPacket rtcp[DELAY_BATCH];
+	size_t rtp_count = 0;
+	size_t rtcp_count = 0;
+
+	for(size_t i = 0; i < count; ++i) {
+		SrtpPacket& packet = batch[i]->rtcp ? rtcp[rtcp_count++] : rtp[rtp_count++];
+
+		packet.data = (uint8_t*) batch[i]->data;
+		packet.size = batch[i]->size;
+		packet.err = err_status_ok;
+	}
+
+	_srtp->process(PROTECT_RTP, rtp, rtp_count);
+	_srtp->process(PROTECT_RTCP, rtcp, rtcp_count);
+
+	rtp_count = rtcp_count = 0;
+
+	for(size_t i = 0; i < count && !_closed; ++i) {
+		bool is_rtcp = batch[i]->rtcp;
+		SrtpPacket& packet = is_rtcp ? rtcp[rtcp_count++] : rtp[rtp_count++];
+
+		if(packet.err != err_status_ok) {
+			DEBUG("unable to protect delayed packet: " << Srtp::errorString(packet.err));
+			++_dropped;
+			continue;
+		}
+
+		++_sent;
+
+		const int argc = 3;
+		Handle<Value> argv[argc] = {
+			String::New(is_rtcp ? "rtcp" : "rtp"),
+			node::Buffer::New((char*) packet.data, packet.size)->handle_,
+			Boolean::New(batch[i]->priority),
+		};
+
+		node::MakeCallback(handle_, "emit", argc, argv);
+	}
+}
+
+void DelayLine::clear() {
+	TimerWheel::instance().remove(&_entry);
+
+	while(_head) {
+		DelayedPacket *packet = _head;
+		_head = packet->next;
+		PacketPool::instance().release(packet);
+	}
+
+	_tail = NULL;
+	_count = 0;
+
+	release();
+}
+
+void DelayLine::retain() {
+	// do not get collected while packets are pending
+	if(!_retained) {
+		Ref();
+		_retained = true;
+	}
+}
+
+void DelayLine::release() {
+	// nothing pending, javascript may collect us again
+	if(!_head && _retained) {
+		Unref();
+		_retained = false;
+	}
+}
+
+v8::Handle<v8::Value> DelayLine::push(const v8::Arguments& args, bool rtcp) {
+	HandleScope scope;
+
+	DelayLine *line = node::ObjectWrap::Unwrap<DelayLine>(args.This()->ToObject());
+
+	if(!node::Buffer::HasInstance(args[0])) {
+		return ThrowException(Exception::TypeError(String::New("Expected buffer")));
+	}
+
+	if(line->_closed) {
+		return scope.Close(False());
+	}
+
+	size_t size = node::Buffer::Length(args[0]);
+
+	// bounded per stream, we drop the newest packet when full
+
+	if(line->_count >= line->_maxPackets || size > DELAYED_PACKET_MAX) {
+		++line->_dropped;
+		return scope.Close(False());
+	}
+
+	DelayedPacket *packet = PacketPool::instance().acquire();
+
+	memcpy(packet->data, node::Buffer::Data(args[0]), size);
+	packet->size = size;
+	packet->rtcp = rtcp;
+	// rtcp always goes first, the caller marks important rtp like keyframes
+	packet->priority = rtcp || args[1]->BooleanValue();
+	packet->due = uv_now(uv_default_loop()) + line->_delay;
+
+	if(line->_tail) {
+		line->_tail->next = packet;
+	} else {
+		line->_head = packet;
+		line->retain();
+	}
+
+	line->_tail = packet;
+	++line->_count;
+
+	line->schedule();
+
+	return scope.Close(True());
+}
+
+v8::Handle<v8::Value> DelayLine::rtp(const v8::Arguments& args) {
+	return push(args, false);
+}
+
+v8::Handle<v8::Value> DelayLine::rtcp(const v8::Arguments& args) {
+	return push(args, true);
+}
+
+v8::Handle<v8::Value> DelayLine::close(const v8::Arguments& args) {
+	HandleScope scope;
+
+	DelayLine *line = node::ObjectWrap::Unwrap<DelayLine>(args.This()->ToObject());
+
+	line->_closed = true;
+	line->clear();
+
+	return scope.Close(Undefined());
+}
+
+v8::Handle<v8::Value> DelayLine::stats(const v8::Arguments& args) {
+	HandleScope scope;
+
+	DelayLine *line = node::ObjectWrap::Unwrap<DelayLine>(args.This()->ToObject());
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("delay"), Integer::New(line->_delay));
+	res->Set(String::New("pending"), Integer::New(line->_count));
+	res->Set(String::New("maxPackets"), Integer::New(line->_maxPackets));
+	res->Set(String::New("sent"), Number::New(line->_sent));
+	res->Set(String::New("dropped"), Number::New(line->_dropped));
+
+	return scope.Close(res);
+}
+
+v8::Handle<v8::Value> DelayLine::poolStats(const v8::Arguments& args) {
+	HandleScope scope;
+
+	PacketPool& pool = PacketPool::instance();
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("allocated"), Number::New(pool.allocated()));
+	res->Set(String::New("available"), Number::New(pool.available()));
+	res->Set(String::New("scheduled"), Number::New(TimerWheel::instance().size()));
+
+	return scope.Close(res);
+}
+
+v8::Handle<v8::Value> DelayLine::trimPool(const v8::Arguments& args) {
+	HandleScope scope;
+
+	PacketPool::instance().trim();
+
+	return scope.Close(Undefined());
+}
+
+v8::Handle<v8::Value> DelayLine::selfTest(const v8::Arguments& args) {
+	HandleScope scope;
+
+	test_results_t results;
+
+	TimerWheel::selfTest(results);
+
+	return scope.Close(testResultsToObject(results));
+}
@@ -0,0 +1,135 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DELAY_LINE_H
+#define DELAY_LINE_H
+
+#include <vector>
+
+#include <node.h>
+#include <v8.h>
+
+#include "timer_wheel.h"
+
+class Srtp;
+
+const int DELAYED_PACKET_MAX = 1500;
+
+// room for the packet and the srtp trailer added when protecting
+const int DELAYED_PACKET_SIZE = DELAYED_PACKET_MAX + 32;
+
+// due packets handed to the srtp backend at once
+const size_t DELAY_BATCH = 32;
+
+struct DelayedPacket {
+	DelayedPacket *next;
+
+	uint64_t due;
+
+	int size;
+	bool rtcp;
+	bool priority;
+
+	char data[DELAYED_PACKET_SIZE];
+};
+
+// packets are recycled through a free list shared by all delay lines, the
+// list is capped so a burst does not keep its memory forever
+
+class PacketPool {
+	public:
+		static PacketPool& instance();
+
+		DelayedPacket* acquire();
+		void release(DelayedPacket *packet);
+
+		// frees all packets on the free list
+		void trim();
+
+		size_t allocated() const { return _allocated; }
+		size_t available() const { return _available; }
+
+	private:
+		PacketPool();
+
+		DelayedPacket *_free;
+
+		size_t _allocated;
+		size_t _available;
+};
+
+// sends packets through the srtp session after a fixed delay
+
+class DelayLine : public node::ObjectWrap {
+	public:
+		DelayLine(Srtp *srtp, int delay, int max_packets);
+		~DelayLine();
+
+		static void init(v8::Handle<v8::Object> exports);
+
+	private:
+		static v8::Persistent<v8::Function> constructor;
+
+		// js functions
+
+		static v8::Handle<v8::Value> New(const v8::Arguments& args);
+		static v8::Handle<v8::Value> rtp(const v8::Arguments& args);
+		static v8::Handle<v8::Value> rtcp(const v8::Arguments& args);
+		static v8::Handle<v8::Value> close(const v8::Arguments& args);
+		static v8::Handle<v8::Value> stats(const v8::Arguments& args);
+		static v8::Handle<v8::Value> poolStats(const v8::Arguments& args);
+		static v8::Handle<v8::Value> trimPool(const v8::Arguments& args);
+		static v8::Handle<v8::Value> selfTest(const v8::Arguments& args);
+
+		// helper
+
+		static v8::Handle<v8::Value> push(const v8::Arguments& args, bool rtcp);
+
+		static void expired(TimerEntry *entry);
+
+		void send(DelayedPacket **batch, size_t count);
+		void schedule();
+		void clear();
+
+		void retain();
+		void release();
+
+		// state
+
+		Srtp *_srtp;
+		v8::Persistent<v8::Object> _srtpHandle;
+
+		int _delay;
+		int _maxPackets;
+
+		// all packets have the same delay, so they leave in the order they came
+		DelayedPacket *_head;
+		DelayedPacket *_tail;
+
+		// only the head of the queue is on the timer wheel
+		TimerEntry _entry;
+
+		int _count;
+		uint64_t _dropped;
+		uint64_t _sent;
+
+		bool _retained;
+		bool _closed;
+};
+
+#endif /* DELAY_LINE_H */
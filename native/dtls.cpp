@@ -26,11 +26,23 @@
 #include <openssl/x509.h>
 #include <openssl/evp.h>
 
+#include "dtls_pool.h"
+#include "load.h"
 #include "helper.h"
 
 const int SRTP_KEY_LEN = 16;
 const int SRTP_SALT_LEN = 14;
 
+// a handshake flight is a few KB at most, do not let a peer make us buffer more
+const int MAX_BUFFER_SIZE = 64 * 1024;
+
+// live bytes of the ssl object as counted through CRYPTO_set_mem_functions in
+// a standalone program against OpenSSL 3.0, fresh from the pool and from the
+// first flight on, when the record buffers, handshake state and later the peer
+// certificate are allocated. older versions will differ somewhat.
+const size_t DTLS_PREPARED_ESTIMATE = 9 * 1024;
+const size_t DTLS_HANDSHAKE_ESTIMATE = 72 * 1024;
+
 using namespace v8;
 
 v8::Persistent<v8::Function> Dtls::constructor;
@@ -50,42 +62,80 @@ const BIO_METHOD Dtls::bioMethod = {
 
 // instantiation
 
-Dtls::Dtls(const char *cert_file, const char *key_file) : _buf(2048), _offset(0), _size(0), _connected(false), _closed(false) {
+SSL_CTX* Dtls::createContext(const char *cert_file, const char *key_file) {
 	OpenSSL_add_ssl_algorithms();
 	SSL_load_error_strings();
 
-	_ctx = SSL_CTX_new(DTLSv1_client_method());
-	SSL_CTX_set_cipher_list(_ctx, "HIGH:!DSS:!aNULL@STRENGTH");
+	SSL_CTX *ctx = SSL_CTX_new(DTLSv1_client_method());
+	SSL_CTX_set_cipher_list(ctx, "HIGH:!DSS:!aNULL@STRENGTH");
 
-	if (!SSL_CTX_use_certificate_file(_ctx, cert_file, SSL_FILETYPE_PEM)) {
+	if (!SSL_CTX_use_certificate_file(ctx, cert_file, SSL_FILETYPE_PEM)) {
 		DEBUG("no certificate found!");
 	}
 
-	if (!SSL_CTX_use_PrivateKey_file(_ctx, key_file, SSL_FILETYPE_PEM)) {
+	if (!SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM)) {
 		DEBUG("no private key found!");
 	}
 
-	if (!SSL_CTX_check_private_key (_ctx)) {
+	if (!SSL_CTX_check_private_key (ctx)) {
 		DEBUG("invalid private key!");
 	}
 
-	SSL_CTX_set_read_ahead(_ctx, 1);
+	SSL_CTX_set_read_ahead(ctx, 1);
+
+	return ctx;
+}
+
+SSL* Dtls::createSsl(SSL_CTX *ctx) {
+	SSL *ssl = SSL_new(ctx);
+
+	SSL_set_tlsext_use_srtp(ssl, "SRTP_AES128_CM_SHA1_80");
+	SSL_set_connect_state(ssl);
+
+	// do not keep the record buffers around while there is nothing to do
+	SSL_set_mode(ssl, SSL_MODE_RELEASE_BUFFERS);
+
+	return ssl;
+}
+
+Dtls::Dtls(const char *cert_file, const char *key_file) : _offset(0), _size(0), _connected(false), _closed(false), _handshaking(false) {
+	_ctx = createContext(cert_file, key_file);
+	_ssl = createSsl(_ctx);
+
+	initBio();
+}
+
+Dtls::Dtls(SSL_CTX *ctx, SSL *ssl, const std::string& fingerprint) : _ctx(ctx), _ssl(ssl), _fingerprint(fingerprint), _offset(0), _size(0), _connected(false), _closed(false), _handshaking(false) {
+	// the context is shared with the pool, hold our own reference
+	CRYPTO_add(&_ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+
+	initBio();
+}
 
-	_ssl = SSL_new(_ctx);
+void Dtls::finishHandshake() {
+	if(_handshaking) {
+		_handshaking = false;
+		--Load::handshakes;
+	}
+}
 
+void Dtls::initBio() {
 	_bio = BIO_new(const_cast<BIO_METHOD *>(&bioMethod));
 	_bio->ptr = this;
 
-	SSL_set_tlsext_use_srtp(_ssl, "SRTP_AES128_CM_SHA1_80");
-
 	SSL_set_bio(_ssl, _bio, _bio);
 }
 
 Dtls::~Dtls() {
 	DEBUG("dtls destroyed");
 
+	finishHandshake();
+
 	//BIO_free(_bio);
-	SSL_free(_ssl);
+	if(_ssl) {
+		SSL_free(_ssl);
+	}
+
 	SSL_CTX_free(_ctx);
 }
 
@@ -100,6 +150,9 @@ void Dtls::init(v8::Handle<v8::Object> exports) {
 	NODE_SET_PROTOTYPE_METHOD(tpl, "close", close);
 	NODE_SET_PROTOTYPE_METHOD(tpl, "connect", tick);
 	NODE_SET_PROTOTYPE_METHOD(tpl, "tick", tick);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "timeout", timeout);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "compact", compact);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "memoryUsage", memoryUsage);
 	NODE_SET_PROTOTYPE_METHOD(tpl, "fingerprint", fingerprint);
 	NODE_SET_PROTOTYPE_METHOD(tpl, "srtpKeys", srtpKeys);
 	constructor = Persistent<Function>::New(tpl->GetFunction());
@@ -112,10 +165,18 @@ v8::Handle<v8::Value> Dtls::New(const v8::Arguments& args) {
 
 	if (args.IsConstructCall()) {
 		// Invoked as constructor: `new MyObject(...)`
-		String::Utf8Value cert_file(args[0]->ToString());
-		String::Utf8Value key_file(args[1]->ToString());
+		Dtls* obj;
+
+		if(DtlsPool::HasInstance(args[0])) {
+			DtlsPool *pool = node::ObjectWrap::Unwrap<DtlsPool>(args[0]->ToObject());
+			obj = new Dtls(pool->context(), pool->acquire(), pool->cachedFingerprint());
+		} else {
+			String::Utf8Value cert_file(args[0]->ToString());
+			String::Utf8Value key_file(args[1]->ToString());
+
+			obj = new Dtls(*cert_file, *key_file);
+		}
 
-		Dtls* obj = new Dtls(*cert_file, *key_file);
 		obj->Wrap(args.This());
 
 		return args.This();
@@ -138,10 +199,30 @@ void Dtls::tick() {
 	}
 
 	if(!_connected) {
+		// counted from our first flight on, sessions waiting for ice do not
+		// hold up admission
+		if(!_handshaking) {
+			_handshaking = true;
+			++Load::handshakes;
+		}
+
+		struct timeval tv;
+
+		if(DTLSv1_get_timeout(_ssl, &tv) && tv.tv_sec == 0 && tv.tv_usec == 0) {
+			// the peer did not answer in time, send the last flight again
+			if(DTLSv1_handle_timeout(_ssl) < 0) {
+				DEBUG("handshake timed out");
+				_closed = true;
+				finishHandshake();
+				return;
+			}
+		}
+
 		int res = SSL_connect(_ssl);
 
 		if(res == 0) {
 			_closed = true;
+			finishHandshake();
 			return;
 		} else if(res < 0) {
 			switch(SSL_get_error(_ssl, res)) {
@@ -152,15 +233,18 @@ void Dtls::tick() {
 				case SSL_ERROR_SSL:
 					//DEBUG(ERR_error_string(NULL));
 					_closed = true;
+					finishHandshake();
 					return;
 				default:
 					_closed = true;
+					finishHandshake();
 					return;
 			}
 		} else {
 			HandleScope scope;
 
 			_connected = true;
+			finishHandshake();
 			DEBUG("connected");
 
 			const int argc = 1;
@@ -172,7 +256,8 @@ void Dtls::tick() {
 		}
 	}
 
-	while(true) {
+	// javascript might have released the session in an event handler
+	while(_ssl) {
 		int res = SSL_read(_ssl, buf, sizeof(buf));
 
 		if(res > 0) {
@@ -213,11 +298,15 @@ v8::Handle<v8::Value> Dtls::decrypt(const v8::Arguments& args) {
 
 	Dtls *dtls = node::ObjectWrap::Unwrap<Dtls>(args.This()->ToObject());
 
+	if(!dtls->_ssl) {
+		return scope.Close(False());
+	}
+
 	// remove clean space at start
 
 	if(dtls->_offset) {
 		dtls->_size -= dtls->_offset;
-		memmove(dtls->_buf.data(), dtls->_buf.data(), dtls->_size);
+		memmove(dtls->_buf.data(), dtls->_buf.data() + dtls->_offset, dtls->_size);
 		dtls->_offset = 0;
 	}
 
@@ -236,6 +325,11 @@ v8::Handle<v8::Value> Dtls::decrypt(const v8::Arguments& args) {
 
 	int new_size = dtls->_size + size;
 
+	if(new_size > MAX_BUFFER_SIZE) {
+		DEBUG("dropping " << size << " bytes, buffer is full");
+		return scope.Close(False());
+	}
+
 	if(new_size > dtls->_buf.size()) {
 		dtls->_buf.resize(new_size);
 	}
@@ -247,7 +341,7 @@ v8::Handle<v8::Value> Dtls::decrypt(const v8::Arguments& args) {
 
 	dtls->tick();
 
-	return scope.Close(Undefined());
+	return scope.Close(True());
 }
 v8::Handle<v8::Value> Dtls::encrypt(const v8::Arguments& args) {
 	HandleScope scope;
@@ -263,6 +357,10 @@ v8::Handle<v8::Value> Dtls::encrypt(const v8::Arguments& args) {
 	char* buf = node::Buffer::Data(buffer);
 	size_t size = node::Buffer::Length(buffer);
 
+	if(!dtls->_ssl) {
+		return ThrowException(Exception::Error(String::New("Session is released")));
+	}
+
 	int res = SSL_write(dtls->_ssl, buf, size);
 
 	if(res != size) {
@@ -278,7 +376,11 @@ v8::Handle<v8::Value> Dtls::close(const v8::Arguments& args) {
 	Dtls *dtls = node::ObjectWrap::Unwrap<Dtls>(args.This()->ToObject());
 
 	dtls->_closed = true;
-	SSL_shutdown(dtls->_ssl);
+	dtls->finishHandshake();
+
+	if(dtls->_ssl) {
+		SSL_shutdown(dtls->_ssl);
+	}
 
 	return scope.Close(Undefined());
 }
@@ -293,17 +395,79 @@ v8::Handle<v8::Value> Dtls::tick(const v8::Arguments& args) {
 	return scope.Close(Undefined());
 }
 
-v8::Handle<v8::Value> Dtls::fingerprint(const v8::Arguments& args) {
+v8::Handle<v8::Value> Dtls::timeout(const v8::Arguments& args) {
+	HandleScope scope;
+
+	Dtls *dtls = node::ObjectWrap::Unwrap<Dtls>(args.This()->ToObject());
+
+	// ms until the handshake wants to retransmit, -1 if nothing is pending
+
+	struct timeval tv;
+
+	if(dtls->_connected || dtls->_closed || !DTLSv1_get_timeout(dtls->_ssl, &tv)) {
+		return scope.Close(Integer::New(-1));
+	}
+
+	return scope.Close(Integer::New(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000));
+}
+
+v8::Handle<v8::Value> Dtls::compact(const v8::Arguments& args) {
+	HandleScope scope;
+
+	Dtls *dtls = node::ObjectWrap::Unwrap<Dtls>(args.This()->ToObject());
+
+	// nothing buffered, the next decrypt allocates again
+
+	if(dtls->_offset >= dtls->_size) {
+		std::vector<char>().swap(dtls->_buf);
+		dtls->_offset = 0;
+		dtls->_size = 0;
+	}
+
+	// the srtp keys are all we need from a finished handshake, the ssl
+	// object with its session and certificates can go
+
+	if(args[0]->BooleanValue() && dtls->_connected && dtls->_ssl) {
+		SSL_free(dtls->_ssl);
+		dtls->_ssl = NULL;
+		dtls->_closed = true;
+
+		std::vector<char>().swap(dtls->_buf);
+		dtls->_offset = 0;
+		dtls->_size = 0;
+	}
+
+	return scope.Close(Undefined());
+}
+
+v8::Handle<v8::Value> Dtls::memoryUsage(const v8::Arguments& args) {
 	HandleScope scope;
 
 	Dtls *dtls = node::ObjectWrap::Unwrap<Dtls>(args.This()->ToObject());
+
+	size_t ssl = 0;
+
+	if(dtls->_ssl) {
+		ssl = dtls->_handshaking || dtls->_connected ? DTLS_HANDSHAKE_ESTIMATE : DTLS_PREPARED_ESTIMATE;
+	}
+
+	size_t buffer = dtls->_buf.capacity();
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("ssl"), Number::New(ssl));
+	res->Set(String::New("buffer"), Number::New(buffer));
+	res->Set(String::New("estimate"), Number::New(ssl + buffer));
+
+	return scope.Close(res);
+}
+
+std::string Dtls::certificateFingerprint(X509 *cert) {
 	unsigned char buf[EVP_MAX_MD_SIZE];
 	unsigned int size;
 
-	X509* x = SSL_get_certificate(dtls->_ssl);
-
 	const EVP_MD *digest = EVP_get_digestbyname("sha256");
-	X509_digest(x, digest, buf, &size);
+	X509_digest(cert, digest, buf, &size);
 
 	std::ostringstream ss;
 
@@ -317,7 +481,19 @@ v8::Handle<v8::Value> Dtls::fingerprint(const v8::Arguments& args) {
 		ss << std::hex << std::uppercase << std::setfill('0') << std::setw(2) << (int) buf[i];
 	}
 
-	return scope.Close(String::New(ss.str().c_str()));
+	return ss.str();
+}
+
+v8::Handle<v8::Value> Dtls::fingerprint(const v8::Arguments& args) {
+	HandleScope scope;
+
+	Dtls *dtls = node::ObjectWrap::Unwrap<Dtls>(args.This()->ToObject());
+
+	if(dtls->_fingerprint.empty() && dtls->_ssl) {
+		dtls->_fingerprint = certificateFingerprint(SSL_get_certificate(dtls->_ssl));
+	}
+
+	return scope.Close(String::New(dtls->_fingerprint.c_str()));
 }
 
 v8::Handle<v8::Value> Dtls::srtpKeys(const v8::Arguments& args) {
@@ -327,7 +503,7 @@ v8::Handle<v8::Value> Dtls::srtpKeys(const v8::Arguments& args) {
 
 	char material[(SRTP_KEY_LEN + SRTP_SALT_LEN) * 2];
 
-	if(!SSL_export_keying_material(dtls->_ssl, (unsigned char *) material, sizeof(material), "EXTRACTOR-dtls_srtp", 19, NULL, 0, 0)) {
+	if(!dtls->_ssl || !SSL_export_keying_material(dtls->_ssl, (unsigned char *) material, sizeof(material), "EXTRACTOR-dtls_srtp", 19, NULL, 0, 0)) {
 		return scope.Close(Undefined());
 	}
 
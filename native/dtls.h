@@ -20,6 +20,7 @@
 #define DTLS_H 
 
 #include <vector>
+#include <string>
 
 #include <node.h>
 #include <v8.h>
@@ -31,10 +32,17 @@
 class Dtls : public node::ObjectWrap {
 	public:
 		Dtls(const char *cert_file, const char *key_file);
+		Dtls(SSL_CTX *ctx, SSL *ssl, const std::string& fingerprint);
 		~Dtls();
 
 		static void init(v8::Handle<v8::Object> exports);
 
+		// shared with the session pool
+
+		static SSL_CTX* createContext(const char *cert_file, const char *key_file);
+		static SSL* createSsl(SSL_CTX *ctx);
+		static std::string certificateFingerprint(X509 *cert);
+
 		void tick();
 		void flush();
 
@@ -48,6 +56,9 @@ class Dtls : public node::ObjectWrap {
 		static v8::Handle<v8::Value> encrypt(const v8::Arguments& args);
 		static v8::Handle<v8::Value> decrypt(const v8::Arguments& args);
 		static v8::Handle<v8::Value> tick(const v8::Arguments& args);
+		static v8::Handle<v8::Value> timeout(const v8::Arguments& args);
+		static v8::Handle<v8::Value> compact(const v8::Arguments& args);
+		static v8::Handle<v8::Value> memoryUsage(const v8::Arguments& args);
 		static v8::Handle<v8::Value> fingerprint(const v8::Arguments& args);
 		static v8::Handle<v8::Value> srtpKeys(const v8::Arguments& args);
 
@@ -63,18 +74,24 @@ class Dtls : public node::ObjectWrap {
 		//static int bioPuts(BIO* bio, const char* str);
 		//static int bioGets(BIO* bio, char* out, int size);
 
+		void initBio();
+		void finishHandshake();
+
 		// state
 
 		SSL_CTX *_ctx;
 		SSL *_ssl;
 		BIO *_bio;
 
+		std::string _fingerprint;
+
 		std::vector<char> _buf;
 		int _offset;
 		int _size;
 
 		bool _connected;
 		bool _closed;
+		bool _handshaking;
 };
 
 #endif /* DTLS_H */
@@ -0,0 +1,186 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dtls_pool.h"
+
+#include "dtls.h"
+#include "helper.h"
+
+// sessions prepared per timer run while refilling
+const size_t REFILL_BATCH = 4;
+
+const size_t DEFAULT_LOW = 8;
+const size_t DEFAULT_HIGH = 32;
+
+using namespace v8;
+
+v8::Persistent<v8::Function> DtlsPool::constructor;
+v8::Persistent<v8::FunctionTemplate> DtlsPool::constructorTemplate;
+
+// instantiation
+
+DtlsPool::DtlsPool(const char *cert_file, const char *key_file, size_t low, size_t high) : _low(low), _high(high), _hits(0), _misses(0), _refilling(false) {
+	_ctx = Dtls::createContext(cert_file, key_file);
+
+	_ready.reserve(_high);
+
+	// all sessions share the certificate, hash it only once
+	SSL *ssl = Dtls::createSsl(_ctx);
+	_fingerprint = Dtls::certificateFingerprint(SSL_get_certificate(ssl));
+	_ready.push_back(ssl);
+
+	_timer = new uv_timer_t;
+	uv_timer_init(uv_default_loop(), _timer);
+	_timer->data = this;
+
+	refill();
+}
+
+DtlsPool::~DtlsPool() {
+	DEBUG("dtls pool destroyed");
+
+	uv_timer_stop(_timer);
+	uv_close((uv_handle_t*) _timer, onClose);
+
+	for(size_t i = 0; i < _ready.size(); ++i) {
+		SSL_free(_ready[i]);
+	}
+
+	SSL_CTX_free(_ctx);
+}
+
+void DtlsPool::init(v8::Handle<v8::Object> exports) {
+	// Prepare constructor template
+	Local<FunctionTemplate> tpl = FunctionTemplate::New(New);
+	tpl->SetClassName(String::NewSymbol("DtlsPool"));
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+	// protoype
+	NODE_SET_PROTOTYPE_METHOD(tpl, "fingerprint", fingerprint);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "stats", stats);
+	constructor = Persistent<Function>::New(tpl->GetFunction());
+	constructorTemplate = Persistent<FunctionTemplate>::New(tpl);
+	// export
+	exports->Set(String::NewSymbol("DtlsPool"), constructor);
+}
+
+bool DtlsPool::HasInstance(v8::Handle<v8::Value> value) {
+	return value->IsObject() && constructorTemplate->HasInstance(value);
+}
+
+v8::Handle<v8::Value> DtlsPool::New(const v8::Arguments& args) {
+	HandleScope scope;
+
+	if (args.IsConstructCall()) {
+		// Invoked as constructor: `new MyObject(...)`
+		String::Utf8Value cert_file(args[0]->ToString());
+		String::Utf8Value key_file(args[1]->ToString());
+
+		size_t low = args[2]->IsNumber() ? args[2]->Uint32Value() : DEFAULT_LOW;
+		size_t high = args[3]->IsNumber() ? args[3]->Uint32Value() : DEFAULT_HIGH;
+
+		if(high < low) {
+			return ThrowException(Exception::RangeError(String::New("High watermark below low watermark")));
+		}
+
+		DtlsPool* obj = new DtlsPool(*cert_file, *key_file, low, high);
+		obj->Wrap(args.This());
+
+		return args.This();
+	} else {
+		// Invoked as plain function `MyObject(...)`, turn into construct call.
+		const int argc = 4;
+		Local<Value> argv[argc] = { args[0], args[1], args[2], args[3] };
+		return scope.Close(constructor->NewInstance(argc, argv));
+	}
+}
+
+// do stuff
+
+SSL* DtlsPool::acquire() {
+	SSL *ssl;
+
+	if(_ready.empty()) {
+		++_misses;
+		ssl = Dtls::createSsl(_ctx);
+	} else {
+		++_hits;
+		ssl = _ready.back();
+		_ready.pop_back();
+	}
+
+	if(_ready.size() < _low) {
+		refill();
+	}
+
+	return ssl;
+}
+
+void DtlsPool::refill() {
+	if(_refilling) {
+		return;
+	}
+
+	// fill up in small batches, other events get handled in between
+	uv_timer_start(_timer, onRefill, 0, 0);
+	_refilling = true;
+}
+
+void DtlsPool::onRefill(uv_timer_t *handle, int status) {
+	DtlsPool *pool = (DtlsPool*) handle->data;
+
+	for(size_t i = 0; i < REFILL_BATCH && pool->_ready.size() < pool->_high; ++i) {
+		pool->_ready.push_back(Dtls::createSsl(pool->_ctx));
+	}
+
+	if(pool->_ready.size() < pool->_high) {
+		// the timer only runs again while there is something to do
+		uv_timer_start(handle, onRefill, 0, 0);
+	} else {
+		pool->_refilling = false;
+	}
+}
+
+void DtlsPool::onClose(uv_handle_t *handle) {
+	delete (uv_timer_t*) handle;
+}
+
+// js functions
+
+v8::Handle<v8::Value> DtlsPool::fingerprint(const v8::Arguments& args) {
+	HandleScope scope;
+
+	DtlsPool *pool = node::ObjectWrap::Unwrap<DtlsPool>(args.This()->ToObject());
+
+	return scope.Close(String::New(pool->_fingerprint.c_str()));
+}
+
+v8::Handle<v8::Value> DtlsPool::stats(const v8::Arguments& args) {
+	HandleScope scope;
+
+	DtlsPool *pool = node::ObjectWrap::Unwrap<DtlsPool>(args.This()->ToObject());
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("ready"), Integer::New(pool->_ready.size()));
+	res->Set(String::New("low"), Integer::New(pool->_low));
+	res->Set(String::New("high"), Integer::New(pool->_high));
+	res->Set(String::New("hits"), Number::New(pool->_hits));
+	res->Set(String::New("misses"), Number::New(pool->_misses));
+
+	return scope.Close(res);
+}
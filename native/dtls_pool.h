@@ -0,0 +1,81 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DTLS_POOL_H
+#define DTLS_POOL_H
+
+#include <vector>
+#include <string>
+
+#include <node.h>
+#include <v8.h>
+
+#include <openssl/ssl.h>
+
+// keeps prepared SSL objects of one certificate around, so answering an
+// offer does not have to load and parse the certificate every time
+
+class DtlsPool : public node::ObjectWrap {
+	public:
+		DtlsPool(const char *cert_file, const char *key_file, size_t low, size_t high);
+		~DtlsPool();
+
+		static void init(v8::Handle<v8::Object> exports);
+
+		static bool HasInstance(v8::Handle<v8::Value> value);
+
+		SSL_CTX* context() { return _ctx; }
+		const std::string& cachedFingerprint() { return _fingerprint; }
+
+		SSL* acquire();
+
+	private:
+		static v8::Persistent<v8::Function> constructor;
+		static v8::Persistent<v8::FunctionTemplate> constructorTemplate;
+
+		// js functions
+
+		static v8::Handle<v8::Value> New(const v8::Arguments& args);
+		static v8::Handle<v8::Value> fingerprint(const v8::Arguments& args);
+		static v8::Handle<v8::Value> stats(const v8::Arguments& args);
+
+		// refilling
+
+		static void onRefill(uv_timer_t *handle, int status);
+		static void onClose(uv_handle_t *handle);
+
+		void refill();
+
+		// state
+
+		SSL_CTX *_ctx;
+		std::string _fingerprint;
+
+		std::vector<SSL*> _ready;
+
+		size_t _low;
+		size_t _high;
+
+		uint64_t _hits;
+		uint64_t _misses;
+
+		uv_timer_t *_timer;
+		bool _refilling;
+};
+
+#endif /* DTLS_POOL_H */
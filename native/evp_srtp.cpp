@@ -0,0 +1,611 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "evp_srtp.h"
+
+#include <cstring>
+
+#include <openssl/crypto.h>
+
+#include "helper.h"
+
+// key derivation labels, rtcp labels are the rtp ones plus 3
+const uint8_t LABEL_ENCRYPTION = 0;
+const uint8_t LABEL_AUTH = 1;
+const uint8_t LABEL_SALT = 2;
+const uint8_t LABEL_RTCP = 3;
+
+const int SHA1_BLOCK_SIZE = 64;
+
+const int RTP_HEADER_SIZE = 12;
+const int RTCP_HEADER_SIZE = 8;
+
+const int REPLAY_WINDOW = 64;
+
+// packets handled in one go inside a batch, bounds the stack usage
+const size_t MAX_BATCH = 32;
+
+// streams tracked per session, like the rtcp sources
+const size_t MAX_STREAMS = 64;
+
+static inline uint32_t read32(const uint8_t *data) {
+	return ((uint32_t) data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static inline void write32(uint8_t *data, uint32_t value) {
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+static inline void append(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+	for(int i = bytes - 1; i >= 0; --i) {
+		out.push_back(value >> (i * 8));
+	}
+}
+
+static inline uint64_t take(const uint8_t *data, int bytes) {
+	uint64_t value = 0;
+
+	for(int i = 0; i < bytes; ++i) {
+		value = (value << 8) | data[i];
+	}
+
+	return value;
+}
+
+// instantiation
+
+EvpSrtp::EvpSrtp(const uint8_t *key, bool exportable) : _exportable(exportable) {
+	const uint8_t *master_key = key;
+	const uint8_t *master_salt = key + EVP_SRTP_KEY_LEN;
+
+	// the derived keys can not be turned back, keep the master key around
+	// for exporting only where this was asked for
+	if(exportable) {
+		memcpy(_master, key, sizeof(_master));
+	} else {
+		memset(_master, 0, sizeof(_master));
+	}
+
+	initKeys(_rtp, master_key, master_salt, 0);
+	initKeys(_rtcp, master_key, master_salt, LABEL_RTCP);
+
+	_tmp = EVP_MD_CTX_create();
+}
+
+EvpSrtp::~EvpSrtp() {
+	freeKeys(_rtp);
+	freeKeys(_rtcp);
+
+	EVP_MD_CTX_destroy(_tmp);
+
+	OPENSSL_cleanse(_master, sizeof(_master));
+}
+
+void EvpSrtp::deriveKey(const uint8_t *master_key, const uint8_t *master_salt, uint8_t label, uint8_t *out, size_t size) {
+	// AES-CM over zeros with (master_salt XOR label << 48) << 16 as IV, we
+	// do not support key derivation rates so the index part stays zero
+
+	uint8_t iv[16];
+
+	memcpy(iv, master_salt, EVP_SRTP_SALT_LEN);
+	iv[7] ^= label;
+	iv[14] = iv[15] = 0;
+
+	memset(out, 0, size);
+
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int len;
+
+	EVP_EncryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, master_key, iv);
+	EVP_EncryptUpdate(ctx, out, &len, out, size);
+
+	EVP_CIPHER_CTX_free(ctx);
+}
+
+void EvpSrtp::initKeys(Keys& keys, const uint8_t *master_key, const uint8_t *master_salt, uint8_t label_base) {
+	uint8_t cipher_key[EVP_SRTP_KEY_LEN];
+	uint8_t auth_key[EVP_SRTP_AUTH_KEY_LEN];
+
+	deriveKey(master_key, master_salt, label_base + LABEL_ENCRYPTION, cipher_key, sizeof(cipher_key));
+	deriveKey(master_key, master_salt, label_base + LABEL_AUTH, auth_key, sizeof(auth_key));
+	deriveKey(master_key, master_salt, label_base + LABEL_SALT, keys.salt, sizeof(keys.salt));
+
+	// the key schedule is done once, packets only set a new IV
+
+	keys.cipher = EVP_CIPHER_CTX_new();
+	EVP_EncryptInit_ex(keys.cipher, EVP_aes_128_ctr(), NULL, cipher_key, NULL);
+
+	// precompute both hmac halves so a packet only costs two short hashes
+
+	uint8_t ipad[SHA1_BLOCK_SIZE];
+	uint8_t opad[SHA1_BLOCK_SIZE];
+
+	memset(ipad, 0x36, sizeof(ipad));
+	memset(opad, 0x5c, sizeof(opad));
+
+	for(int i = 0; i < EVP_SRTP_AUTH_KEY_LEN; ++i) {
+		ipad[i] ^= auth_key[i];
+		opad[i] ^= auth_key[i];
+	}
+
+	keys.inner = EVP_MD_CTX_create();
+	EVP_DigestInit_ex(keys.inner, EVP_sha1(), NULL);
+	EVP_DigestUpdate(keys.inner, ipad, sizeof(ipad));
+
+	keys.outer = EVP_MD_CTX_create();
+	EVP_DigestInit_ex(keys.outer, EVP_sha1(), NULL);
+	EVP_DigestUpdate(keys.outer, opad, sizeof(opad));
+
+	OPENSSL_cleanse(cipher_key, sizeof(cipher_key));
+	OPENSSL_cleanse(auth_key, sizeof(auth_key));
+	OPENSSL_cleanse(ipad, sizeof(ipad));
+	OPENSSL_cleanse(opad, sizeof(opad));
+}
+
+void EvpSrtp::freeKeys(Keys& keys) {
+	EVP_CIPHER_CTX_free(keys.cipher);
+	EVP_MD_CTX_destroy(keys.inner);
+	EVP_MD_CTX_destroy(keys.outer);
+
+	OPENSSL_cleanse(keys.salt, sizeof(keys.salt));
+}
+
+// state export
+
+// per stream: ssrc, flags, rtp index (48 bit), rtp window, srtcp index
+// (31 bit), srtcp window
+const size_t STREAM_STATE_SIZE = 4 + 1 + 6 + 8 + 4 + 8;
+
+const uint8_t STATE_RTP_INIT = 1;
+const uint8_t STATE_RTCP_INIT = 2;
+
+void EvpSrtp::serialize(std::vector<uint8_t>& out) const {
+	out.insert(out.end(), _master, _master + sizeof(_master));
+
+	append(out, _streams.size(), 4);
+
+	for(auto it = _streams.begin(); it != _streams.end(); ++it) {
+		const Stream& s = it->second;
+
+		append(out, it->first, 4);
+		append(out, (s.rtpInit ? STATE_RTP_INIT : 0) | (s.rtcpInit ? STATE_RTCP_INIT : 0), 1);
+		append(out, s.rtpIndex, 6);
+		append(out, s.rtpWindow, 8);
+		append(out, s.rtcpIndex, 4);
+		append(out, s.rtcpWindow, 8);
+	}
+}
+
+EvpSrtp* EvpSrtp::deserialize(const uint8_t *data, size_t size, size_t& offset) {
+	if(offset + EVP_SRTP_MASTER_LEN + 4 > size) {
+		return NULL;
+	}
+
+	const uint8_t *master = data + offset;
+	offset += EVP_SRTP_MASTER_LEN;
+
+	size_t count = take(data + offset, 4);
+	offset += 4;
+
+	if(count > MAX_STREAMS || count > (size - offset) / STREAM_STATE_SIZE) {
+		return NULL;
+	}
+
+	// a migrated session may move on again
+	EvpSrtp *res = new EvpSrtp(master, true);
+
+	for(size_t i = 0; i < count; ++i, offset += STREAM_STATE_SIZE) {
+		const uint8_t *cur = data + offset;
+
+		Stream& s = res->_streams[take(cur, 4)];
+		uint8_t flags = cur[4];
+
+		s.rtpInit = flags & STATE_RTP_INIT;
+		s.rtpIndex = take(cur + 5, 6);
+		s.rtpWindow = take(cur + 11, 8);
+		s.rtcpInit = flags & STATE_RTCP_INIT;
+		s.rtcpIndex = take(cur + 19, 4) & 0x7fffffff;
+		s.rtcpWindow = take(cur + 23, 8);
+	}
+
+	return res;
+}
+
+size_t EvpSrtp::memoryUsage() const {
+	// map nodes carry three pointers and the color next to the value
+	const size_t node_size = sizeof(std::pair<const uint32_t,Stream>) + 4 * sizeof(void*);
+
+	return sizeof(*this) + _streams.size() * node_size;
+}
+
+// helper
+
+EvpSrtp::Stream* EvpSrtp::stream(uint32_t ssrc) {
+	std::map<uint32_t,Stream>::iterator it = _streams.find(ssrc);
+
+	if(it == _streams.end()) {
+		if(_streams.size() >= MAX_STREAMS) {
+			return NULL;
+		}
+
+		it = _streams.insert(std::make_pair(ssrc, Stream())).first;
+	}
+
+	return &it->second;
+}
+
+void EvpSrtp::crypt(Keys& keys, uint32_t ssrc, uint64_t index, uint8_t *data, size_t size) {
+	// IV = (salt << 16) XOR (ssrc << 64) XOR (index << 16)
+
+	uint8_t iv[16];
+
+	memcpy(iv, keys.salt, EVP_SRTP_SALT_LEN);
+	iv[14] = iv[15] = 0;
+
+	iv[4] ^= ssrc >> 24;
+	iv[5] ^= ssrc >> 16;
+	iv[6] ^= ssrc >> 8;
+	iv[7] ^= ssrc;
+
+	for(int i = 0; i < 6; ++i) {
+		iv[13 - i] ^= index >> (i * 8);
+	}
+
+	int len;
+
+	EVP_EncryptInit_ex(keys.cipher, NULL, NULL, NULL, iv);
+	EVP_EncryptUpdate(keys.cipher, data, &len, data, size);
+}
+
+void EvpSrtp::mac(Keys& keys, const uint8_t *data, size_t size, const uint8_t *extra, size_t extra_size, uint8_t *tag) {
+	uint8_t digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_size;
+
+	EVP_MD_CTX_copy_ex(_tmp, keys.inner);
+	EVP_DigestUpdate(_tmp, data, size);
+
+	if(extra_size) {
+		EVP_DigestUpdate(_tmp, extra, extra_size);
+	}
+
+	EVP_DigestFinal_ex(_tmp, digest, &digest_size);
+
+	EVP_MD_CTX_copy_ex(_tmp, keys.outer);
+	EVP_DigestUpdate(_tmp, digest, digest_size);
+	EVP_DigestFinal_ex(_tmp, digest, &digest_size);
+
+	memcpy(tag, digest, EVP_SRTP_TAG_LEN);
+}
+
+int EvpSrtp::headerSize(const uint8_t *data, int size) {
+	if(size < RTP_HEADER_SIZE || (data[0] >> 6) != 2) {
+		return -1;
+	}
+
+	int header_size = RTP_HEADER_SIZE + (data[0] & 0x0f) * 4;
+
+	if(data[0] & 0x10) {
+		// header extension
+		if(size < header_size + 4) {
+			return -1;
+		}
+
+		header_size += 4 + ((data[header_size + 2] << 8) | data[header_size + 3]) * 4;
+	}
+
+	if(header_size > size) {
+		return -1;
+	}
+
+	return header_size;
+}
+
+uint64_t EvpSrtp::estimateIndex(const Stream& stream, uint16_t seq) {
+	// RFC 3711 section 3.3.1
+
+	if(!stream.rtpInit) {
+		return seq;
+	}
+
+	uint32_t roc = stream.rtpIndex >> 16;
+	int s_l = stream.rtpIndex & 0xffff;
+	uint32_t v = roc;
+
+	if(s_l < 32768) {
+		if((int) seq - s_l > 32768 && roc > 0) {
+			v = roc - 1;
+		}
+	} else {
+		if(s_l - 32768 > (int) seq) {
+			v = roc + 1;
+		}
+	}
+
+	return ((uint64_t) v << 16) | seq;
+}
+
+err_status_t EvpSrtp::checkReplay(bool init, uint64_t highest, uint64_t window, uint64_t index) {
+	if(!init || index > highest) {
+		return err_status_ok;
+	}
+
+	uint64_t delta = highest - index;
+
+	if(delta >= REPLAY_WINDOW) {
+		return err_status_replay_old;
+	}
+
+	if(window & (1ull << delta)) {
+		return err_status_replay_fail;
+	}
+
+	return err_status_ok;
+}
+
+void EvpSrtp::updateReplay(bool& init, uint64_t& highest, uint64_t& window, uint64_t index) {
+	if(!init) {
+		init = true;
+		highest = index;
+		window = 1;
+	} else if(index > highest) {
+		uint64_t shift = index - highest;
+
+		window = shift >= REPLAY_WINDOW ? 1 : (window << shift) | 1;
+		highest = index;
+	} else {
+		window |= 1ull << (highest - index);
+	}
+}
+
+// rtp
+
+void EvpSrtp::protectRtp(SrtpPacket *packets, size_t count) {
+	uint64_t indices[MAX_BATCH];
+	int headers[MAX_BATCH];
+
+	while(count > MAX_BATCH) {
+		protectRtp(packets, MAX_BATCH);
+		packets += MAX_BATCH;
+		count -= MAX_BATCH;
+	}
+
+	// all keystreams first ...
+
+	for(size_t i = 0; i < count; ++i) {
+		SrtpPacket& packet = packets[i];
+
+		headers[i] = headerSize(packet.data, packet.size);
+
+		if(headers[i] < 0) {
+			packet.err = err_status_bad_param;
+			continue;
+		}
+
+		uint32_t ssrc = read32(packet.data + 8);
+		uint16_t seq = (packet.data[2] << 8) | packet.data[3];
+
+		// the echo sends what it received, no replay checks when sending
+		Stream *s = stream(ssrc);
+
+		if(s == NULL) {
+			packet.err = err_status_no_ctx;
+			continue;
+		}
+
+		uint64_t index = estimateIndex(*s, seq);
+
+		if(!s->rtpInit || index > s->rtpIndex) {
+			s->rtpInit = true;
+			s->rtpIndex = index;
+		}
+
+		indices[i] = index;
+
+		crypt(_rtp, ssrc, index, packet.data + headers[i], packet.size - headers[i]);
+
+		packet.err = err_status_ok;
+	}
+
+	// ... then all macs
+
+	for(size_t i = 0; i < count; ++i) {
+		SrtpPacket& packet = packets[i];
+
+		if(packet.err != err_status_ok) {
+			continue;
+		}
+
+		uint8_t roc[4];
+		write32(roc, indices[i] >> 16);
+
+		mac(_rtp, packet.data, packet.size, roc, sizeof(roc), packet.data + packet.size);
+		packet.size += EVP_SRTP_TAG_LEN;
+	}
+}
+
+void EvpSrtp::unprotectRtp(SrtpPacket *packets, size_t count) {
+	uint64_t indices[MAX_BATCH];
+	int headers[MAX_BATCH];
+
+	while(count > MAX_BATCH) {
+		unprotectRtp(packets, MAX_BATCH);
+		packets += MAX_BATCH;
+		count -= MAX_BATCH;
+	}
+
+	// authenticate everything first ...
+
+	for(size_t i = 0; i < count; ++i) {
+		SrtpPacket& packet = packets[i];
+
+		int size = packet.size - EVP_SRTP_TAG_LEN;
+
+		headers[i] = size > 0 ? headerSize(packet.data, size) : -1;
+
+		if(headers[i] < 0) {
+			packet.err = err_status_bad_param;
+			continue;
+		}
+
+		uint32_t ssrc = read32(packet.data + 8);
+		uint16_t seq = (packet.data[2] << 8) | packet.data[3];
+
+		// unknown streams are checked against a blank state and only stored
+		// once the packet turned out to be authentic
+		std::map<uint32_t,Stream>::iterator it = _streams.find(ssrc);
+		Stream fresh;
+		Stream *s = it != _streams.end() ? &it->second : &fresh;
+
+		uint64_t index = estimateIndex(*s, seq);
+
+		packet.err = checkReplay(s->rtpInit, s->rtpIndex, s->rtpWindow, index);
+
+		if(packet.err != err_status_ok) {
+			continue;
+		}
+
+		uint8_t roc[4];
+		write32(roc, index >> 16);
+
+		uint8_t tag[EVP_SRTP_TAG_LEN];
+		mac(_rtp, packet.data, size, roc, sizeof(roc), tag);
+
+		if(CRYPTO_memcmp(tag, packet.data + size, EVP_SRTP_TAG_LEN) != 0) {
+			packet.err = err_status_auth_fail;
+			continue;
+		}
+
+		if(s == &fresh && (s = stream(ssrc)) == NULL) {
+			packet.err = err_status_no_ctx;
+			continue;
+		}
+
+		// only authentic packets move the window
+		updateReplay(s->rtpInit, s->rtpIndex, s->rtpWindow, index);
+
+		indices[i] = index;
+		packet.size = size;
+	}
+
+	// ... then decrypt
+
+	for(size_t i = 0; i < count; ++i) {
+		SrtpPacket& packet = packets[i];
+
+		if(packet.err != err_status_ok) {
+			continue;
+		}
+
+		crypt(_rtp, read32(packet.data + 8), indices[i], packet.data + headers[i], packet.size - headers[i]);
+	}
+}
+
+// rtcp
+
+void EvpSrtp::protectRtcp(SrtpPacket *packets, size_t count) {
+	for(size_t i = 0; i < count; ++i) {
+		SrtpPacket& packet = packets[i];
+
+		if(packet.size < RTCP_HEADER_SIZE) {
+			packet.err = err_status_bad_param;
+			continue;
+		}
+
+		uint32_t ssrc = read32(packet.data + 4);
+
+		Stream *s = stream(ssrc);
+
+		if(s == NULL) {
+			packet.err = err_status_no_ctx;
+			continue;
+		}
+
+		// like libsrtp we start counting at 1
+		s->rtcpIndex = (s->rtcpIndex + 1) & 0x7fffffff;
+
+		crypt(_rtcp, ssrc, s->rtcpIndex, packet.data + RTCP_HEADER_SIZE, packet.size - RTCP_HEADER_SIZE);
+
+		// E flag, we always encrypt
+		write32(packet.data + packet.size, 0x80000000 | s->rtcpIndex);
+		packet.size += EVP_SRTCP_TRAILER_LEN;
+
+		packet.err = err_status_ok;
+	}
+
+	for(size_t i = 0; i < count; ++i) {
+		SrtpPacket& packet = packets[i];
+
+		if(packet.err != err_status_ok) {
+			continue;
+		}
+
+		mac(_rtcp, packet.data, packet.size, NULL, 0, packet.data + packet.size);
+		packet.size += EVP_SRTP_TAG_LEN;
+	}
+}
+
+void EvpSrtp::unprotectRtcp(SrtpPacket *packets, size_t count) {
+	for(size_t i = 0; i < count; ++i) {
+		SrtpPacket& packet = packets[i];
+
+		int size = packet.size - EVP_SRTP_TAG_LEN - EVP_SRTCP_TRAILER_LEN;
+
+		if(size < RTCP_HEADER_SIZE) {
+			packet.err = err_status_bad_param;
+			continue;
+		}
+
+		uint32_t ssrc = read32(packet.data + 4);
+		uint32_t trailer = read32(packet.data + size);
+		uint32_t index = trailer & 0x7fffffff;
+
+		std::map<uint32_t,Stream>::iterator it = _streams.find(ssrc);
+		Stream fresh;
+		Stream *s = it != _streams.end() ? &it->second : &fresh;
+
+		packet.err = checkReplay(s->rtcpInit, s->rtcpIndex, s->rtcpWindow, index);
+
+		if(packet.err != err_status_ok) {
+			continue;
+		}
+
+		uint8_t tag[EVP_SRTP_TAG_LEN];
+		mac(_rtcp, packet.data, size + EVP_SRTCP_TRAILER_LEN, NULL, 0, tag);
+
+		if(CRYPTO_memcmp(tag, packet.data + size + EVP_SRTCP_TRAILER_LEN, EVP_SRTP_TAG_LEN) != 0) {
+			packet.err = err_status_auth_fail;
+			continue;
+		}
+
+		if(s == &fresh && (s = stream(ssrc)) == NULL) {
+			packet.err = err_status_no_ctx;
+			continue;
+		}
+
+		updateReplay(s->rtcpInit, s->rtcpIndex, s->rtcpWindow, index);
+
+		if(trailer & 0x80000000) {
+			crypt(_rtcp, ssrc, index, packet.data + RTCP_HEADER_SIZE, size - RTCP_HEADER_SIZE);
+		}
+
+		packet.size = size;
+	}
+}
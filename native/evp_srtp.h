@@ -0,0 +1,126 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVP_SRTP_H
+#define EVP_SRTP_H
+
+#include <map>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include <openssl/evp.h>
+
+#include <srtp/srtp.h>
+
+const int EVP_SRTP_KEY_LEN = 16;
+const int EVP_SRTP_SALT_LEN = 14;
+const int EVP_SRTP_AUTH_KEY_LEN = 20;
+const int EVP_SRTP_TAG_LEN = 10;
+
+const int EVP_SRTP_MASTER_LEN = EVP_SRTP_KEY_LEN + EVP_SRTP_SALT_LEN;
+
+// E flag and index appended to SRTCP packets
+const int EVP_SRTCP_TRAILER_LEN = 4;
+
+struct SrtpPacket {
+	uint8_t *data;
+	int size;
+	err_status_t err;
+};
+
+// AES_CM_128_HMAC_SHA1_80 (RFC 3711) on top of OpenSSL EVP, meant as a
+// faster replacement for libsrtp. Contexts are set up once per key and only
+// get a new IV per packet. Packets are processed in batches, all keystreams
+// first, then all MACs, to keep the AES and SHA units busy.
+
+class EvpSrtp {
+	public:
+		// key is master key followed by master salt, it is only kept if the
+		// session may be exported later
+		EvpSrtp(const uint8_t *key, bool exportable);
+		~EvpSrtp();
+
+		void protectRtp(SrtpPacket *packets, size_t count);
+		void unprotectRtp(SrtpPacket *packets, size_t count);
+		void protectRtcp(SrtpPacket *packets, size_t count);
+		void unprotectRtcp(SrtpPacket *packets, size_t count);
+
+		static void deriveKey(const uint8_t *master_key, const uint8_t *master_salt, uint8_t label, uint8_t *out, size_t size);
+
+		// master key and per ssrc state to continue the session elsewhere,
+		// restoring returns NULL on malformed data and advances offset
+		void serialize(std::vector<uint8_t>& out) const;
+		static EvpSrtp* deserialize(const uint8_t *data, size_t size, size_t& offset);
+
+		// our own structures, the OpenSSL contexts are not included
+		size_t memoryUsage() const;
+
+		bool exportable() const { return _exportable; }
+
+	private:
+		struct Keys {
+			uint8_t salt[EVP_SRTP_SALT_LEN];
+
+			EVP_CIPHER_CTX *cipher;
+
+			// hmac state after absorbing the padded key
+			EVP_MD_CTX *inner;
+			EVP_MD_CTX *outer;
+		};
+
+		struct Stream {
+			Stream() : rtpInit(false), rtpIndex(0), rtpWindow(0), rtcpInit(false), rtcpIndex(0), rtcpWindow(0) {}
+
+			// highest rtp packet index (roc and sequence number)
+			bool rtpInit;
+			uint64_t rtpIndex;
+			uint64_t rtpWindow;
+
+			// highest srtcp index
+			bool rtcpInit;
+			uint64_t rtcpIndex;
+			uint64_t rtcpWindow;
+		};
+
+		void initKeys(Keys& keys, const uint8_t *master_key, const uint8_t *master_salt, uint8_t label_base);
+		void freeKeys(Keys& keys);
+
+		// NULL once too many streams are tracked
+		Stream* stream(uint32_t ssrc);
+
+		void crypt(Keys& keys, uint32_t ssrc, uint64_t index, uint8_t *data, size_t size);
+		void mac(Keys& keys, const uint8_t *data, size_t size, const uint8_t *extra, size_t extra_size, uint8_t *tag);
+
+		static int headerSize(const uint8_t *data, int size);
+		static uint64_t estimateIndex(const Stream& stream, uint16_t seq);
+		static err_status_t checkReplay(bool init, uint64_t highest, uint64_t window, uint64_t index);
+		static void updateReplay(bool& init, uint64_t& highest, uint64_t& window, uint64_t index);
+
+		bool _exportable;
+		uint8_t _master[EVP_SRTP_MASTER_LEN];
+
+		Keys _rtp;
+		Keys _rtcp;
+
+		EVP_MD_CTX *_tmp;
+
+		std::map<uint32_t,Stream> _streams;
+};
+
+#endif /* EVP_SRTP_H */
@@ -0,0 +1,41 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "load.h"
+
+using namespace v8;
+
+int64_t Load::srtpSessions = 0;
+int64_t Load::handshakes = 0;
+uint64_t Load::srtpPackets = 0;
+
+void Load::init(v8::Handle<v8::Object> exports) {
+	exports->Set(String::NewSymbol("loadStats"), FunctionTemplate::New(stats)->GetFunction());
+}
+
+v8::Handle<v8::Value> Load::stats(const v8::Arguments& args) {
+	HandleScope scope;
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("srtpSessions"), Number::New(srtpSessions));
+	res->Set(String::New("handshakes"), Number::New(handshakes));
+	res->Set(String::New("srtpPackets"), Number::New(srtpPackets));
+
+	return scope.Close(res);
+}
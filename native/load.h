@@ -0,0 +1,47 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <stdint.h>
+
+#include <node.h>
+#include <v8.h>
+
+// process wide counters the admission control decides on
+
+class Load {
+	public:
+		static void init(v8::Handle<v8::Object> exports);
+
+		// native objects alive, including those waiting for the garbage collector
+		static int64_t srtpSessions;
+
+		// dtls sessions which sent their first flight but are neither
+		// connected nor closed
+		static int64_t handshakes;
+
+		// packets passed through any srtp session
+		static uint64_t srtpPackets;
+
+	private:
+		static v8::Handle<v8::Value> stats(const v8::Arguments& args);
+};
+
+#endif /* LOAD_H */
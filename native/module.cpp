@@ -20,14 +20,26 @@
 #include <v8.h>
 
 #include "dtls.h"
+#include "dtls_pool.h"
 #include "srtp.h"
+#include "rtcp.h"
+#include "sdp.h"
+#include "delay_line.h"
+#include "send_queue.h"
+#include "load.h"
 
 using namespace v8;
 
 extern "C"
 void initAll(Handle<Object> exports) {
 	Dtls::init(exports);
+	DtlsPool::init(exports);
 	Srtp::init(exports);
+	RtcpStats::init(exports);
+	Sdp::init(exports);
+	DelayLine::init(exports);
+	SendQueue::init(exports);
+	Load::init(exports);
 }
 
 NODE_MODULE(native_stuff, initAll)
@@ -0,0 +1,487 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rtcp.h"
+
+#include <cstring>
+
+#include "self_test.h"
+#include "helper.h"
+
+using namespace v8;
+
+const int RTCP_SR = 200;
+const int RTCP_RR = 201;
+const int RTCP_SDES = 202;
+const int RTCP_BYE = 203;
+const int RTCP_RTPFB = 205;
+const int RTCP_PSFB = 206;
+
+const int RTPFB_NACK = 1;
+const int PSFB_PLI = 1;
+const int PSFB_FIR = 4;
+
+const size_t REPORT_BLOCK_SIZE = 24;
+
+// a hostile peer should not be able to make us track arbitrary many sources
+const size_t MAX_SOURCES = 64;
+
+static inline uint32_t read32(const uint8_t *data) {
+	return ((uint32_t) data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static inline uint16_t read16(const uint8_t *data) {
+	return (data[0] << 8) | data[1];
+}
+
+static inline void write32(uint8_t *data, uint32_t value) {
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+RtcpSourceStats::RtcpSourceStats() :
+	firstSeen(0), lastSeen(0),
+	senderReports(0), receiverReports(0), sdes(0), byes(0),
+	nacks(0), nackedPackets(0), plis(0), firs(0),
+	hasReport(false), fractionLost(0), cumulativeLost(0), highestSeq(0), jitter(0),
+	rtt(-1), minRtt(-1), rttSamples(0),
+	srPos(0)
+{
+	for(int i = 0; i < RTCP_SR_HISTORY; ++i) {
+		srNtp[i] = 0;
+		srTime[i] = 0;
+	}
+}
+
+RtcpStats::RtcpStats() : _packets(0), _malformed(0) {
+}
+
+RtcpSourceStats* RtcpStats::source(uint32_t ssrc, uint64_t now) {
+	std::map<uint32_t,RtcpSourceStats>::iterator it = _sources.find(ssrc);
+
+	if(it == _sources.end()) {
+		if(_sources.size() >= MAX_SOURCES) {
+			return NULL;
+		}
+
+		it = _sources.insert(std::make_pair(ssrc, RtcpSourceStats())).first;
+		it->second.firstSeen = now;
+	}
+
+	it->second.lastSeen = now;
+
+	return &it->second;
+}
+
+void RtcpStats::feed(const uint8_t *data, size_t size, uint64_t now) {
+	++_packets;
+
+	// walk through the compound packet
+
+	while(size >= 4) {
+		int version = data[0] >> 6;
+		int count = data[0] & 0x1f;
+		int type = data[1];
+		size_t length = (read16(data + 2) + 1) * 4;
+
+		if(version != 2 || length > size) {
+			++_malformed;
+			return;
+		}
+
+		switch(type) {
+			case RTCP_SR:
+				senderReport(data, length, count, now);
+				break;
+			case RTCP_RR:
+				receiverReport(data, length, count, now);
+				break;
+			case RTCP_SDES:
+				if(length >= 8) {
+					RtcpSourceStats *stats = source(read32(data + 4), now);
+
+					if(stats) {
+						++stats->sdes;
+					}
+				}
+				break;
+			case RTCP_BYE:
+				bye(data, length, count, now);
+				break;
+			case RTCP_RTPFB:
+				transportFeedback(data, length, count, now);
+				break;
+			case RTCP_PSFB:
+				payloadFeedback(data, length, count, now);
+				break;
+			default:
+				break;
+		}
+
+		data += length;
+		size -= length;
+	}
+}
+
+void RtcpStats::senderReport(const uint8_t *data, size_t size, int count, uint64_t now) {
+	if(size < 28) {
+		++_malformed;
+		return;
+	}
+
+	RtcpSourceStats *stats = source(read32(data + 4), now);
+
+	if(stats) {
+		++stats->senderReports;
+
+		// remember when this report passed us to calculate the round trip
+		// time once the peer references it in a report block
+		uint32_t ntp = ((uint32_t) read16(data + 10) << 16) | read16(data + 12);
+
+		stats->srNtp[stats->srPos] = ntp;
+		stats->srTime[stats->srPos] = now;
+		stats->srPos = (stats->srPos + 1) % RTCP_SR_HISTORY;
+	}
+
+	reportBlocks(data + 28, size - 28, count, now);
+}
+
+void RtcpStats::receiverReport(const uint8_t *data, size_t size, int count, uint64_t now) {
+	if(size < 8) {
+		++_malformed;
+		return;
+	}
+
+	RtcpSourceStats *stats = source(read32(data + 4), now);
+
+	if(stats) {
+		++stats->receiverReports;
+	}
+
+	reportBlocks(data + 8, size - 8, count, now);
+}
+
+void RtcpStats::reportBlocks(const uint8_t *data, size_t size, int count, uint64_t now) {
+	if(count * REPORT_BLOCK_SIZE > size) {
+		++_malformed;
+		return;
+	}
+
+	for(int i = 0; i < count; ++i, data += REPORT_BLOCK_SIZE) {
+		RtcpSourceStats *stats = source(read32(data), now);
+
+		if(!stats) {
+			continue;
+		}
+
+		stats->hasReport = true;
+		stats->fractionLost = data[4];
+
+		// 24 bit signed
+		int32_t lost = (data[5] << 16) | (data[6] << 8) | data[7];
+		stats->cumulativeLost = (lost & 0x800000) ? lost - 0x1000000 : lost;
+
+		stats->highestSeq = read32(data + 8);
+		stats->jitter = read32(data + 12);
+
+		uint32_t lsr = read32(data + 16);
+		uint32_t dlsr = read32(data + 20);
+
+		if(lsr == 0) {
+			continue;
+		}
+
+		// find the sender report the peer is referencing
+
+		for(int j = 0; j < RTCP_SR_HISTORY; ++j) {
+			if(stats->srNtp[j] != lsr || stats->srTime[j] == 0) {
+				continue;
+			}
+
+			// dlsr is in units of 1/65536 seconds
+			double rtt = (double) (now - stats->srTime[j]) - dlsr * 1000.0 / 65536.0;
+
+			if(rtt < 0) {
+				rtt = 0;
+			}
+
+			stats->rtt = rtt;
+
+			if(stats->minRtt < 0 || rtt < stats->minRtt) {
+				stats->minRtt = rtt;
+			}
+
+			++stats->rttSamples;
+
+			break;
+		}
+	}
+}
+
+void RtcpStats::bye(const uint8_t *data, size_t size, int count, uint64_t now) {
+	if(4 + (size_t) count * 4 > size) {
+		++_malformed;
+		return;
+	}
+
+	for(int i = 0; i < count; ++i) {
+		RtcpSourceStats *stats = source(read32(data + 4 + i * 4), now);
+
+		if(stats) {
+			++stats->byes;
+		}
+	}
+}
+
+void RtcpStats::transportFeedback(const uint8_t *data, size_t size, int fmt, uint64_t now) {
+	if(size < 12) {
+		++_malformed;
+		return;
+	}
+
+	if(fmt != RTPFB_NACK) {
+		return;
+	}
+
+	RtcpSourceStats *stats = source(read32(data + 8), now);
+
+	if(!stats) {
+		return;
+	}
+
+	// each entry names a lost packet and a bitmask of 16 following ones
+
+	for(size_t offset = 12; offset + 4 <= size; offset += 4) {
+		uint16_t blp = read16(data + offset + 2);
+
+		++stats->nacks;
+		stats->nackedPackets += 1 + __builtin_popcount(blp);
+	}
+}
+
+void RtcpStats::payloadFeedback(const uint8_t *data, size_t size, int fmt, uint64_t now) {
+	if(size < 12) {
+		++_malformed;
+		return;
+	}
+
+	if(fmt == PSFB_PLI) {
+		RtcpSourceStats *stats = source(read32(data + 8), now);
+
+		if(stats) {
+			++stats->plis;
+		}
+	} else if(fmt == PSFB_FIR) {
+		// the media source is in the entries, the field in the header is unused
+
+		for(size_t offset = 12; offset + 8 <= size; offset += 8) {
+			RtcpSourceStats *stats = source(read32(data + offset), now);
+
+			if(stats) {
+				++stats->firs;
+			}
+		}
+	}
+}
+
+// self test
+
+static void writeHeader(uint8_t *data, int count, int type, size_t size) {
+	data[0] = 0x80 | count;
+	data[1] = type;
+	data[2] = (size / 4 - 1) >> 8;
+	data[3] = size / 4 - 1;
+}
+
+static bool testTruncated() {
+	RtcpStats stats;
+	uint8_t buf[28] = {0};
+
+	// sender report claiming more than we got
+	writeHeader(buf, 0, RTCP_SR, sizeof(buf));
+	write32(buf + 4, 0x11111111);
+	stats.feed(buf, 16, 1000);
+
+	// sender report too short to hold the sender info
+	writeHeader(buf, 0, RTCP_SR, 8);
+	stats.feed(buf, 8, 1000);
+
+	return stats.malformed() == 2 && stats.sources().empty();
+}
+
+static bool testLengthPastEnd() {
+	RtcpStats stats;
+	uint8_t buf[16] = {0};
+
+	// a valid receiver report followed by a bye pointing past the end
+	writeHeader(buf, 0, RTCP_RR, 8);
+	write32(buf + 4, 0x11111111);
+
+	writeHeader(buf + 8, 1, RTCP_BYE, 64);
+	write32(buf + 12, 0x22222222);
+
+	stats.feed(buf, sizeof(buf), 1000);
+
+	const std::map<uint32_t,RtcpSourceStats>& sources = stats.sources();
+
+	return stats.malformed() == 1 && sources.size() == 1 && sources.begin()->second.receiverReports == 1;
+}
+
+static bool testRoundTrip() {
+	RtcpStats stats;
+
+	// the sender report passes us at 1000 ms
+	uint8_t sr[28] = {0};
+	writeHeader(sr, 0, RTCP_SR, sizeof(sr));
+	write32(sr + 4, 0x11111111);
+	write32(sr + 8, 0xaaaa1234);
+	write32(sr + 12, 0x5678bbbb);
+	stats.feed(sr, sizeof(sr), 1000);
+
+	// the receiver answers at 1650 ms after holding it for 500 ms
+	uint8_t rr[32] = {0};
+	writeHeader(rr, 1, RTCP_RR, sizeof(rr));
+	write32(rr + 4, 0x22222222);
+	write32(rr + 8, 0x11111111);
+	write32(rr + 24, 0x12345678);
+	write32(rr + 28, 0x8000);
+	stats.feed(rr, sizeof(rr), 1650);
+
+	const RtcpSourceStats& source = stats.sources().find(0x11111111)->second;
+
+	return stats.malformed() == 0 && source.rttSamples == 1 && source.rtt == 150 && source.minRtt == 150;
+}
+
+static bool testSourceLimit() {
+	RtcpStats stats;
+
+	// byes carry up to 31 sources each
+	uint8_t buf[3 * (4 + 31 * 4)];
+	uint32_t ssrc = 1;
+
+	for(int i = 0; i < 3; ++i) {
+		uint8_t *bye = buf + i * (4 + 31 * 4);
+
+		writeHeader(bye, 31, RTCP_BYE, 4 + 31 * 4);
+
+		for(int j = 0; j < 31; ++j) {
+			write32(bye + 4 + j * 4, ssrc++);
+		}
+	}
+
+	stats.feed(buf, sizeof(buf), 1000);
+
+	return stats.malformed() == 0 && stats.sources().size() == MAX_SOURCES;
+}
+
+static bool testSdes() {
+	RtcpStats stats;
+
+	// receiver report followed by a chunk with the cname of the same source
+	uint8_t buf[28] = {0};
+	writeHeader(buf, 0, RTCP_RR, 8);
+	write32(buf + 4, 0x11111111);
+
+	writeHeader(buf + 8, 1, RTCP_SDES, 20);
+	write32(buf + 12, 0x11111111);
+	buf[16] = 1;
+	buf[17] = 8;
+	memcpy(buf + 18, "echo@cam", 8);
+
+	stats.feed(buf, sizeof(buf), 1000);
+
+	const RtcpSourceStats& source = stats.sources().find(0x11111111)->second;
+
+	return stats.malformed() == 0 && stats.sources().size() == 1 && source.receiverReports == 1 && source.sdes == 1;
+}
+
+static bool testNack() {
+	RtcpStats stats;
+
+	// packet 100 alone, then 200 with 201, 202 and 216 in the bitmask
+	uint8_t buf[20] = {0};
+	writeHeader(buf, RTPFB_NACK, RTCP_RTPFB, sizeof(buf));
+	write32(buf + 4, 0x22222222);
+	write32(buf + 8, 0x11111111);
+	write32(buf + 12, (100 << 16) | 0x0000);
+	write32(buf + 16, (200 << 16) | 0x8003);
+
+	stats.feed(buf, sizeof(buf), 1000);
+
+	const RtcpSourceStats& source = stats.sources().find(0x11111111)->second;
+
+	return stats.malformed() == 0 && source.nacks == 2 && source.nackedPackets == 5;
+}
+
+static bool testPli() {
+	RtcpStats stats;
+
+	uint8_t buf[12] = {0};
+	writeHeader(buf, PSFB_PLI, RTCP_PSFB, sizeof(buf));
+	write32(buf + 4, 0x22222222);
+	write32(buf + 8, 0x11111111);
+
+	stats.feed(buf, sizeof(buf), 1000);
+	stats.feed(buf, sizeof(buf), 1100);
+
+	const RtcpSourceStats& source = stats.sources().find(0x11111111)->second;
+
+	return stats.malformed() == 0 && source.plis == 2 && source.firs == 0;
+}
+
+static bool testFir() {
+	RtcpStats stats;
+
+	// one request for each of two sources, the media source field is unused
+	uint8_t buf[28] = {0};
+	writeHeader(buf, PSFB_FIR, RTCP_PSFB, sizeof(buf));
+	write32(buf + 4, 0x22222222);
+	write32(buf + 12, 0x11111111);
+	buf[16] = 1;
+	write32(buf + 20, 0x33333333);
+	buf[24] = 1;
+
+	stats.feed(buf, sizeof(buf), 1000);
+
+	const std::map<uint32_t,RtcpSourceStats>& sources = stats.sources();
+
+	return stats.malformed() == 0 && sources.size() == 2 && sources.find(0x11111111)->second.firs == 1 && sources.find(0x33333333)->second.firs == 1;
+}
+
+void RtcpStats::init(v8::Handle<v8::Object> exports) {
+	exports->Set(String::NewSymbol("rtcpSelfTest"), FunctionTemplate::New(selfTest)->GetFunction());
+}
+
+v8::Handle<v8::Value> RtcpStats::selfTest(const v8::Arguments& args) {
+	HandleScope scope;
+
+	test_results_t results;
+
+	results.push_back(std::make_pair("truncated packet", testTruncated()));
+	results.push_back(std::make_pair("length past the end", testLengthPastEnd()));
+	results.push_back(std::make_pair("round trip time", testRoundTrip()));
+	results.push_back(std::make_pair("source limit", testSourceLimit()));
+	results.push_back(std::make_pair("sdes", testSdes()));
+	results.push_back(std::make_pair("nack", testNack()));
+	results.push_back(std::make_pair("pli", testPli()));
+	results.push_back(std::make_pair("fir", testFir()));
+
+	return scope.Close(testResultsToObject(results));
+}
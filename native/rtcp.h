@@ -0,0 +1,111 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTCP_H
+#define RTCP_H
+
+#include <map>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <stdint.h>
+
+#include <node.h>
+#include <v8.h>
+
+// sender reports we remember per source to match them with LSR
+const int RTCP_SR_HISTORY = 8;
+
+struct RtcpSourceStats {
+	RtcpSourceStats();
+
+	uint64_t firstSeen;
+	uint64_t lastSeen;
+
+	uint64_t senderReports;
+	uint64_t receiverReports;
+	uint64_t sdes;
+	uint64_t byes;
+
+	// feedback about this source
+
+	uint64_t nacks;
+	uint64_t nackedPackets;
+	uint64_t plis;
+	uint64_t firs;
+
+	// last report block about this source
+
+	bool hasReport;
+	uint8_t fractionLost;
+	int32_t cumulativeLost;
+	uint32_t highestSeq;
+	uint32_t jitter;
+
+	// round trip time in ms, negative while unknown
+
+	double rtt;
+	double minRtt;
+	uint64_t rttSamples;
+
+	// sender reports passing through us, middle 32 bits of the NTP time and
+	// when we saw them
+
+	uint32_t srNtp[RTCP_SR_HISTORY];
+	uint64_t srTime[RTCP_SR_HISTORY];
+	int srPos;
+};
+
+// parses decrypted compound RTCP in place and keeps statistics per SSRC
+
+class RtcpStats {
+	public:
+		RtcpStats();
+
+		void feed(const uint8_t *data, size_t size, uint64_t now);
+
+		const std::map<uint32_t,RtcpSourceStats>& sources() const { return _sources; }
+
+		uint64_t packets() const { return _packets; }
+		uint64_t malformed() const { return _malformed; }
+
+		static void init(v8::Handle<v8::Object> exports);
+
+	private:
+		// js functions
+
+		static v8::Handle<v8::Value> selfTest(const v8::Arguments& args);
+
+		// helper
+
+		RtcpSourceStats* source(uint32_t ssrc, uint64_t now);
+
+		void senderReport(const uint8_t *data, size_t size, int count, uint64_t now);
+		void receiverReport(const uint8_t *data, size_t size, int count, uint64_t now);
+		void reportBlocks(const uint8_t *data, size_t size, int count, uint64_t now);
+		void bye(const uint8_t *data, size_t size, int count, uint64_t now);
+		void transportFeedback(const uint8_t *data, size_t size, int fmt, uint64_t now);
+		void payloadFeedback(const uint8_t *data, size_t size, int fmt, uint64_t now);
+
+		std::map<uint32_t,RtcpSourceStats> _sources;
+
+		uint64_t _packets;
+		uint64_t _malformed;
+};
+
+#endif /* RTCP_H */
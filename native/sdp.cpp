@@ -0,0 +1,390 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sdp.h"
+
+#include <cstring>
+#include <cstdlib>
+
+#include "helper.h"
+
+using namespace v8;
+
+// room for the lines we inject for each m-line
+const size_t ANSWER_RESERVE = 512;
+
+static bool startsWith(const char *line, size_t size, const char *prefix, size_t prefix_size) {
+	return size >= prefix_size && memcmp(line, prefix, prefix_size) == 0;
+}
+
+#define STARTS_WITH(line, size, prefix) startsWith(line, size, prefix, sizeof(prefix) - 1)
+
+// returns the next space separated token and advances the cursor
+
+static bool nextToken(const char *&cur, const char *end, const char *&token, size_t &token_size) {
+	while(cur < end && *cur == ' ') {
+		++cur;
+	}
+
+	if(cur >= end) {
+		return false;
+	}
+
+	token = cur;
+
+	while(cur < end && *cur != ' ') {
+		++cur;
+	}
+
+	token_size = cur - token;
+
+	return true;
+}
+
+// instantiation
+
+Sdp::Sdp() : _current(-1), _needsCredentials(false), _first(true) {
+}
+
+void Sdp::init(v8::Handle<v8::Object> exports) {
+	exports->Set(String::NewSymbol("rewriteOffer"), FunctionTemplate::New(rewriteOffer)->GetFunction());
+}
+
+// do stuff
+
+void Sdp::appendLine(const char *line, size_t size) {
+	if(!_first) {
+		answer.append("\r\n", 2);
+	}
+
+	answer.append(line, size);
+	_first = false;
+}
+
+void Sdp::injectCredentials() {
+	std::string tmp;
+
+	tmp = "a=ice-ufrag:" + _credentials.ufrag;
+	appendLine(tmp.data(), tmp.size());
+
+	tmp = "a=ice-pwd:" + _credentials.pwd;
+	appendLine(tmp.data(), tmp.size());
+
+	tmp = "a=fingerprint:" + _credentials.fingerprint;
+	appendLine(tmp.data(), tmp.size());
+
+	_needsCredentials = false;
+}
+
+bool Sdp::processLine(const char *line, size_t size, credentials_fun& fun) {
+	SdpMedia *media = _current >= 0 ? &this->media[_current] : NULL;
+
+	// inject our credentials in front of the first attribute of the m-line
+
+	if(_needsCredentials && STARTS_WITH(line, size, "a=") && !STARTS_WITH(line, size, "a=crypto")) {
+		injectCredentials();
+	}
+
+	if(STARTS_WITH(line, size, "m=")) {
+		// the previous m-line had no attributes at all
+		if(_needsCredentials) {
+			injectCredentials();
+		}
+
+		// m-lines describe a media stream: "m=<type> <port> <profile> <fmt> ..."
+
+		const char *cur = line + 2;
+		const char *end = line + size;
+
+		const char *type, *port, *profile, *fmt;
+		size_t type_size, port_size, profile_size, fmt_size;
+
+		if(!nextToken(cur, end, type, type_size) || !nextToken(cur, end, port, port_size) || !nextToken(cur, end, profile, profile_size)) {
+			DEBUG("invalid m-line");
+			appendLine(line, size);
+			return true;
+		}
+
+		SdpMedia entry;
+		entry.index = this->media.size();
+		entry.type.assign(type, type_size);
+		entry.mid = entry.type;
+		entry.profile.assign(profile, profile_size);
+
+		while(nextToken(cur, end, fmt, fmt_size)) {
+			char *num_end;
+			long pt = strtol(fmt, &num_end, 10);
+
+			// sctp m-lines might carry non-numeric formats
+			if(num_end != fmt) {
+				entry.payloads.push_back(pt);
+			}
+		}
+
+		this->media.push_back(entry);
+		_current = entry.index;
+
+		_credentials = SdpCredentials();
+
+		if(!fun(this->media.back(), _credentials)) {
+			return false;
+		}
+
+		_needsCredentials = true;
+
+		appendLine(line, size);
+	} else if(STARTS_WITH(line, size, "a=mid:")) {
+		if(media) {
+			media->mid.assign(line + 6, size - 6);
+		}
+
+		appendLine(line, size);
+	} else if(STARTS_WITH(line, size, "a=rtpmap:")) {
+		// "a=rtpmap:<payload type> <encoding name>/<clock rate>[/<parameters>]"
+
+		if(media) {
+			const char *cur = line + 9;
+			const char *end = line + size;
+
+			char *num_end;
+			long pt = strtol(cur, &num_end, 10);
+
+			if(num_end != cur && num_end < end && *num_end == ' ') {
+				const char *name = num_end + 1;
+				const char *slash = (const char*) memchr(name, '/', end - name);
+
+				media->codecs[pt].assign(name, (slash ? slash : end) - name);
+			}
+		}
+
+		appendLine(line, size);
+	} else if(STARTS_WITH(line, size, "a=ice-ufrag:")) {
+		// replaced by ours
+		(media ? media->ufrag : ufrag).assign(line + 12, size - 12);
+	} else if(STARTS_WITH(line, size, "a=ice-pwd:")) {
+		// replaced by ours
+		(media ? media->pwd : pwd).assign(line + 10, size - 10);
+	} else if(STARTS_WITH(line, size, "a=ice-options:")) {
+		// line not needed
+	} else if(STARTS_WITH(line, size, "a=setup:actpass")) {
+		// we are acting as dtls client
+		appendLine("a=setup:active", 14);
+	} else if(STARTS_WITH(line, size, "a=rtcp-mux")) {
+		if(media) {
+			media->rtcpMux = true;
+		}
+
+		appendLine(line, size);
+	} else if(STARTS_WITH(line, size, "a=candidate:")) {
+		// handed to libnice by the caller
+		if(media) {
+			media->candidates.push_back(std::string(line, size));
+		}
+	} else if(STARTS_WITH(line, size, "a=crypto:")) {
+		// we are using dtls-srtp, so this line has to go
+	} else if(STARTS_WITH(line, size, "a=fingerprint:")) {
+		// we add our own above
+	} else if(STARTS_WITH(line, size, "a=group:BUNDLE ")) {
+		// this is disabled for now because of datachannels
+		// TODO: figure out how to handle this correctly ...
+	} else {
+		appendLine(line, size);
+	}
+
+	return true;
+}
+
+bool Sdp::rewrite(const char *data, size_t size, credentials_fun fun) {
+	answer.clear();
+	answer.reserve(size + ANSWER_RESERVE);
+
+	const char *cur = data;
+	const char *end = data + size;
+
+	while(true) {
+		// lines end with CRLF, but we also take a bare LF from sloppy clients
+
+		const char *sep = (const char*) memchr(cur, '\n', end - cur);
+		const char *line_end = sep ? sep : end;
+
+		if(line_end > cur && line_end[-1] == '\r') {
+			--line_end;
+		}
+
+		if(sep == NULL) {
+			// the last m-line had no attributes, our credentials still belong
+			// in front of the final line break
+			if(_needsCredentials && line_end == cur) {
+				injectCredentials();
+			}
+
+			// an empty last line keeps the final line break in the answer
+			if(!processLine(cur, line_end - cur, fun)) {
+				return false;
+			}
+
+			if(_needsCredentials) {
+				injectCredentials();
+			}
+
+			return true;
+		}
+
+		if(!processLine(cur, line_end - cur, fun)) {
+			return false;
+		}
+
+		cur = sep + 1;
+	}
+}
+
+// js functions
+
+static Local<Object> mediaToObject(const SdpMedia& media) {
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("index"), Integer::New(media.index));
+	res->Set(String::New("type"), String::New(media.type.data(), media.type.size()));
+	res->Set(String::New("profile"), String::New(media.profile.data(), media.profile.size()));
+	res->Set(String::New("mid"), String::New(media.mid.data(), media.mid.size()));
+
+	if(!media.ufrag.empty()) {
+		res->Set(String::New("ufrag"), String::New(media.ufrag.data(), media.ufrag.size()));
+	}
+
+	if(!media.pwd.empty()) {
+		res->Set(String::New("pwd"), String::New(media.pwd.data(), media.pwd.size()));
+	}
+
+	res->Set(String::New("rtcpMux"), Boolean::New(media.rtcpMux));
+
+	Local<Array> payloads = Array::New(media.payloads.size());
+
+	for(size_t i = 0; i < media.payloads.size(); ++i) {
+		payloads->Set(i, Integer::New(media.payloads[i]));
+	}
+
+	res->Set(String::New("payloads"), payloads);
+
+	Local<Object> codecs = Object::New();
+
+	for(std::map<int,std::string>::const_iterator it = media.codecs.begin(); it != media.codecs.end(); ++it) {
+		codecs->Set(Integer::New(it->first), String::New(it->second.data(), it->second.size()));
+	}
+
+	res->Set(String::New("codecs"), codecs);
+
+	Local<Array> candidates = Array::New(media.candidates.size());
+
+	for(size_t i = 0; i < media.candidates.size(); ++i) {
+		const std::string& candidate = media.candidates[i];
+		candidates->Set(i, String::New(candidate.data(), candidate.size()));
+	}
+
+	res->Set(String::New("candidates"), candidates);
+
+	return res;
+}
+
+static std::string getString(Handle<Object> obj, const char *key) {
+	Local<Value> value = obj->Get(String::New(key));
+
+	if(value->IsUndefined() || value->IsNull()) {
+		return std::string();
+	}
+
+	String::Utf8Value str(value->ToString());
+
+	return std::string(*str, str.length());
+}
+
+v8::Handle<v8::Value> Sdp::rewriteOffer(const v8::Arguments& args) {
+	HandleScope scope;
+
+	if(!args[0]->IsString()) {
+		return ThrowException(Exception::TypeError(String::New("Expected sdp string")));
+	}
+
+	if(!args[1]->IsFunction()) {
+		return ThrowException(Exception::TypeError(String::New("Expected credentials callback")));
+	}
+
+	String::Utf8Value offer(args[0]);
+	Local<Function> callback = Local<Function>::Cast(args[1]);
+
+	// ask javascript for the credentials of each m-line as soon as we see it
+
+	auto fun = [&callback](const SdpMedia& media, SdpCredentials& credentials) -> bool {
+		HandleScope scope;
+
+		const int argc = 1;
+		Handle<Value> argv[argc] = {
+			mediaToObject(media),
+		};
+
+		Local<Value> res = callback->Call(Context::GetCurrent()->Global(), argc, argv);
+
+		if(res.IsEmpty()) {
+			// exception is pending and will be passed on
+			return false;
+		}
+
+		if(!res->IsObject()) {
+			ThrowException(Exception::TypeError(String::New("Expected credentials object")));
+			return false;
+		}
+
+		Local<Object> obj = res->ToObject();
+
+		credentials.ufrag = getString(obj, "ufrag");
+		credentials.pwd = getString(obj, "pwd");
+		credentials.fingerprint = getString(obj, "fingerprint");
+
+		return true;
+	};
+
+	Sdp sdp;
+
+	if(!sdp.rewrite(*offer, offer.length(), fun)) {
+		return Handle<Value>();
+	}
+
+	// pack results
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("answer"), String::New(sdp.answer.data(), sdp.answer.size()));
+
+	if(!sdp.ufrag.empty()) {
+		res->Set(String::New("ufrag"), String::New(sdp.ufrag.data(), sdp.ufrag.size()));
+	}
+
+	if(!sdp.pwd.empty()) {
+		res->Set(String::New("pwd"), String::New(sdp.pwd.data(), sdp.pwd.size()));
+	}
+
+	Local<Array> media = Array::New(sdp.media.size());
+
+	for(size_t i = 0; i < sdp.media.size(); ++i) {
+		media->Set(i, mediaToObject(sdp.media[i]));
+	}
+
+	res->Set(String::New("media"), media);
+
+	return scope.Close(res);
+}
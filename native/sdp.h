@@ -0,0 +1,98 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SDP_H
+#define SDP_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <node.h>
+#include <v8.h>
+
+struct SdpCredentials {
+	std::string ufrag;
+	std::string pwd;
+	std::string fingerprint;
+};
+
+struct SdpMedia {
+	SdpMedia() : index(0), rtcpMux(false) {}
+
+	int index;
+
+	std::string type;
+	std::string profile;
+	std::string mid;
+
+	std::string ufrag;
+	std::string pwd;
+
+	bool rtcpMux;
+
+	std::vector<int> payloads;
+	std::vector<std::string> candidates;
+
+	// encoding names from the rtpmap lines by payload type
+	std::map<int,std::string> codecs;
+};
+
+// turns an offer into an answer in a single pass over the lines, collecting
+// everything we need to know about the media streams on the way
+
+class Sdp {
+	public:
+		// called for every m-line, returns what we inject into the answer
+		typedef std::function<bool(const SdpMedia& media, SdpCredentials& credentials)> credentials_fun;
+
+		Sdp();
+
+		bool rewrite(const char *data, size_t size, credentials_fun fun);
+
+		static void init(v8::Handle<v8::Object> exports);
+
+		// results
+
+		std::string answer;
+		std::vector<SdpMedia> media;
+
+		std::string ufrag;
+		std::string pwd;
+
+	private:
+		// js functions
+
+		static v8::Handle<v8::Value> rewriteOffer(const v8::Arguments& args);
+
+		// helper
+
+		bool processLine(const char *line, size_t size, credentials_fun& fun);
+		void appendLine(const char *line, size_t size);
+		void injectCredentials();
+
+		// state
+
+		int _current;
+		SdpCredentials _credentials;
+		bool _needsCredentials;
+		bool _first;
+};
+
+#endif /* SDP_H */
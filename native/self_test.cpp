@@ -0,0 +1,38 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "self_test.h"
+
+using namespace v8;
+
+v8::Local<v8::Object> testResultsToObject(const test_results_t& results) {
+	bool passed = true;
+	Local<Object> list = Object::New();
+
+	for(size_t i = 0; i < results.size(); ++i) {
+		list->Set(String::New(results[i].first), Boolean::New(results[i].second));
+		passed = passed && results[i].second;
+	}
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("passed"), Boolean::New(passed));
+	res->Set(String::New("tests"), list);
+
+	return res;
+}
@@ -0,0 +1,33 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SELF_TEST_H
+#define SELF_TEST_H
+
+#include <vector>
+#include <utility>
+
+#include <v8.h>
+
+// names and outcomes of native tests in the order they ran
+typedef std::vector<std::pair<const char*,bool> > test_results_t;
+
+// { passed, tests: { name: passed } } as printed by src/self_test.coffee
+v8::Local<v8::Object> testResultsToObject(const test_results_t& results);
+
+#endif /* SELF_TEST_H */
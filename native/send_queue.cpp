@@ -0,0 +1,347 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "send_queue.h"
+
+#include <cstring>
+
+#include <node_buffer.h>
+
+#include "helper.h"
+
+const size_t DEFAULT_MAX_PACKETS = 256;
+const size_t DEFAULT_MAX_BYTES = 256 * 1024;
+
+using namespace v8;
+
+v8::Persistent<v8::Function> SendQueue::constructor;
+
+size_t SendQueue::totalBytes = 0;
+size_t SendQueue::budgetBytes = 0;
+uint64_t SendQueue::totalDropped = 0;
+
+// instantiation
+
+SendQueue::SendQueue(size_t max_packets, size_t max_bytes, drop_policy_t policy) :
+	_maxPackets(max_packets), _maxBytes(max_bytes), _policy(policy), _bytes(0),
+	_sentPackets(0), _droppedPackets(0), _droppedBytes(0)
+{
+}
+
+SendQueue::~SendQueue() {
+	while(!_queue.empty()) {
+		pop();
+	}
+}
+
+void SendQueue::init(v8::Handle<v8::Object> exports) {
+	// Prepare constructor template
+	Local<FunctionTemplate> tpl = FunctionTemplate::New(New);
+	tpl->SetClassName(String::NewSymbol("SendQueue"));
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+	// protoype
+	NODE_SET_PROTOTYPE_METHOD(tpl, "push", push);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "empty", empty);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "drain", drain);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "clear", clear);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "compact", compact);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "stats", stats);
+	constructor = Persistent<Function>::New(tpl->GetFunction());
+	// static
+	constructor->Set(String::NewSymbol("setBudget"), FunctionTemplate::New(setBudget)->GetFunction());
+	constructor->Set(String::NewSymbol("totals"), FunctionTemplate::New(totals)->GetFunction());
+	// export
+	exports->Set(String::NewSymbol("SendQueue"), constructor);
+}
+
+v8::Handle<v8::Value> SendQueue::New(const v8::Arguments& args) {
+	HandleScope scope;
+
+	if (args.IsConstructCall()) {
+		// Invoked as constructor: `new MyObject(...)`
+		size_t max_packets = args[0]->IsNumber() ? args[0]->Uint32Value() : DEFAULT_MAX_PACKETS;
+		size_t max_bytes = args[1]->IsNumber() ? args[1]->Uint32Value() : DEFAULT_MAX_BYTES;
+
+		drop_policy_t policy = DROP_PREFER_PRIORITY;
+
+		if(args[2]->IsString()) {
+			String::Utf8Value name(args[2]);
+
+			if(strcmp(*name, "drop-oldest") == 0) {
+				policy = DROP_OLDEST;
+			} else if(strcmp(*name, "drop-newest") == 0) {
+				policy = DROP_NEWEST;
+			} else if(strcmp(*name, "prefer-priority") == 0) {
+				policy = DROP_PREFER_PRIORITY;
+			} else {
+				return ThrowException(Exception::TypeError(String::New("Unknown drop policy")));
+			}
+		}
+
+		SendQueue* obj = new SendQueue(max_packets, max_bytes, policy);
+		obj->Wrap(args.This());
+
+		return args.This();
+	} else {
+		// Invoked as plain function `MyObject(...)`, turn into construct call.
+		const int argc = 3;
+		Local<Value> argv[argc] = { args[0], args[1], args[2] };
+		return scope.Close(constructor->NewInstance(argc, argv));
+	}
+}
+
+// do stuff
+
+bool SendQueue::full(size_t size) {
+	if(_queue.size() + 1 > _maxPackets || _bytes + size > _maxBytes) {
+		return true;
+	}
+
+	// an empty queue always takes one packet, stalled sessions using up the
+	// budget must not starve the healthy ones
+	if(budgetBytes && !_queue.empty() && totalBytes + size > budgetBytes) {
+		return true;
+	}
+
+	return false;
+}
+
+void SendQueue::pop() {
+	QueuedPacket& packet = _queue.front();
+
+	_bytes -= packet.size;
+	totalBytes -= packet.size;
+
+	packet.buffer.Dispose();
+	packet.buffer.Clear();
+
+	_queue.pop_front();
+}
+
+void SendQueue::drop(std::deque<QueuedPacket>::iterator it) {
+	++_droppedPackets;
+	++totalDropped;
+	_droppedBytes += it->size;
+
+	_bytes -= it->size;
+	totalBytes -= it->size;
+
+	it->buffer.Dispose();
+	it->buffer.Clear();
+
+	_queue.erase(it);
+}
+
+bool SendQueue::makeRoom(size_t size, bool priority) {
+	while(full(size)) {
+		if(_queue.empty()) {
+			// larger than the queue itself
+			return false;
+		}
+
+		switch(_policy) {
+			case DROP_NEWEST:
+				return false;
+			case DROP_OLDEST:
+				drop(_queue.begin());
+				break;
+			case DROP_PREFER_PRIORITY:
+				{
+					std::deque<QueuedPacket>::iterator it = _queue.begin();
+
+					while(it != _queue.end() && it->priority) {
+						++it;
+					}
+
+					if(it != _queue.end()) {
+						drop(it);
+					} else if(priority) {
+						// only priority packets left, the oldest one has to go
+						drop(_queue.begin());
+					} else {
+						return false;
+					}
+				}
+				break;
+		}
+	}
+
+	return true;
+}
+
+v8::Handle<v8::Value> SendQueue::push(const v8::Arguments& args) {
+	HandleScope scope;
+
+	SendQueue *queue = node::ObjectWrap::Unwrap<SendQueue>(args.This()->ToObject());
+
+	if(!node::Buffer::HasInstance(args[1])) {
+		return ThrowException(Exception::TypeError(String::New("Expected buffer")));
+	}
+
+	int component = args[0]->Int32Value();
+	Local<Object> buffer = args[1]->ToObject();
+	bool priority = args[2]->BooleanValue();
+
+	size_t size = node::Buffer::Length(buffer);
+
+	if(!queue->makeRoom(size, priority)) {
+		++queue->_droppedPackets;
+		++totalDropped;
+		queue->_droppedBytes += size;
+
+		return scope.Close(False());
+	}
+
+	// we keep the buffer itself, no need to copy
+
+	queue->_queue.push_back(QueuedPacket());
+
+	QueuedPacket& packet = queue->_queue.back();
+	packet.component = component;
+	packet.priority = priority;
+	packet.size = size;
+	packet.buffer = Persistent<Object>::New(buffer);
+
+	queue->_bytes += size;
+	totalBytes += size;
+
+	return scope.Close(True());
+}
+
+v8::Handle<v8::Value> SendQueue::empty(const v8::Arguments& args) {
+	HandleScope scope;
+
+	SendQueue *queue = node::ObjectWrap::Unwrap<SendQueue>(args.This()->ToObject());
+
+	return scope.Close(Boolean::New(queue->_queue.empty()));
+}
+
+v8::Handle<v8::Value> SendQueue::drain(const v8::Arguments& args) {
+	HandleScope scope;
+
+	SendQueue *queue = node::ObjectWrap::Unwrap<SendQueue>(args.This()->ToObject());
+
+	if(!args[0]->IsFunction()) {
+		return ThrowException(Exception::TypeError(String::New("Expected send function")));
+	}
+
+	Local<Function> send = Local<Function>::Cast(args[0]);
+
+	// hand out packets until the transport refuses to take more
+
+	while(!queue->_queue.empty()) {
+		// take it out while javascript has it, the callback might touch the queue
+		QueuedPacket packet = queue->_queue.front();
+		queue->_queue.pop_front();
+
+		const int argc = 2;
+		Handle<Value> argv[argc] = {
+			Integer::New(packet.component),
+			packet.buffer,
+		};
+
+		Local<Value> res = send->Call(Context::GetCurrent()->Global(), argc, argv);
+
+		if(res.IsEmpty() || res->NumberValue() <= 0) {
+			// retry with the next drain
+			queue->_queue.push_front(packet);
+
+			if(res.IsEmpty()) {
+				// exception is pending and will be passed on
+				return Handle<Value>();
+			}
+
+			break;
+		}
+
+		++queue->_sentPackets;
+
+		queue->_bytes -= packet.size;
+		totalBytes -= packet.size;
+
+		packet.buffer.Dispose();
+	}
+
+	return scope.Close(Integer::New(queue->_queue.size()));
+}
+
+v8::Handle<v8::Value> SendQueue::clear(const v8::Arguments& args) {
+	HandleScope scope;
+
+	SendQueue *queue = node::ObjectWrap::Unwrap<SendQueue>(args.This()->ToObject());
+
+	while(!queue->_queue.empty()) {
+		queue->pop();
+	}
+
+	return scope.Close(Undefined());
+}
+
+v8::Handle<v8::Value> SendQueue::compact(const v8::Arguments& args) {
+	HandleScope scope;
+
+	SendQueue *queue = node::ObjectWrap::Unwrap<SendQueue>(args.This()->ToObject());
+
+	// a deque keeps the map it grew to while busy, a fresh one is back to the
+	// 568 bytes (map and one block) libstdc++ allocates for an empty deque
+	std::deque<QueuedPacket> compacted(queue->_queue.begin(), queue->_queue.end());
+	queue->_queue.swap(compacted);
+
+	return scope.Close(Undefined());
+}
+
+v8::Handle<v8::Value> SendQueue::stats(const v8::Arguments& args) {
+	HandleScope scope;
+
+	SendQueue *queue = node::ObjectWrap::Unwrap<SendQueue>(args.This()->ToObject());
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("packets"), Integer::New(queue->_queue.size()));
+	res->Set(String::New("bytes"), Number::New(queue->_bytes));
+	res->Set(String::New("sentPackets"), Number::New(queue->_sentPackets));
+	res->Set(String::New("droppedPackets"), Number::New(queue->_droppedPackets));
+	res->Set(String::New("droppedBytes"), Number::New(queue->_droppedBytes));
+
+	return scope.Close(res);
+}
+
+v8::Handle<v8::Value> SendQueue::setBudget(const v8::Arguments& args) {
+	HandleScope scope;
+
+	if(!args[0]->IsNumber()) {
+		return ThrowException(Exception::TypeError(String::New("Expected number of bytes")));
+	}
+
+	// 0 disables the process wide limit
+	budgetBytes = args[0]->IntegerValue();
+
+	return scope.Close(Undefined());
+}
+
+v8::Handle<v8::Value> SendQueue::totals(const v8::Arguments& args) {
+	HandleScope scope;
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("bytes"), Number::New(totalBytes));
+	res->Set(String::New("budget"), Number::New(budgetBytes));
+	res->Set(String::New("dropped"), Number::New(totalDropped));
+
+	return scope.Close(res);
+}
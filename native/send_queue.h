@@ -0,0 +1,96 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <deque>
+#include <stdint.h>
+
+#include <node.h>
+#include <v8.h>
+
+enum drop_policy_t {
+	DROP_OLDEST,
+	DROP_NEWEST,
+	// drop packets without priority (everything but rtcp and keyframes) first
+	DROP_PREFER_PRIORITY,
+};
+
+struct QueuedPacket {
+	int component;
+	bool priority;
+	size_t size;
+	v8::Persistent<v8::Object> buffer;
+};
+
+// bounded queue of packets waiting to be sent to a peer
+
+class SendQueue : public node::ObjectWrap {
+	public:
+		SendQueue(size_t max_packets, size_t max_bytes, drop_policy_t policy);
+		~SendQueue();
+
+		static void init(v8::Handle<v8::Object> exports);
+
+	private:
+		static v8::Persistent<v8::Function> constructor;
+
+		// js functions
+
+		static v8::Handle<v8::Value> New(const v8::Arguments& args);
+		static v8::Handle<v8::Value> push(const v8::Arguments& args);
+		static v8::Handle<v8::Value> empty(const v8::Arguments& args);
+		static v8::Handle<v8::Value> drain(const v8::Arguments& args);
+		static v8::Handle<v8::Value> clear(const v8::Arguments& args);
+		static v8::Handle<v8::Value> compact(const v8::Arguments& args);
+		static v8::Handle<v8::Value> stats(const v8::Arguments& args);
+
+		static v8::Handle<v8::Value> setBudget(const v8::Arguments& args);
+		static v8::Handle<v8::Value> totals(const v8::Arguments& args);
+
+		// helper
+
+		bool full(size_t size);
+		bool makeRoom(size_t size, bool priority);
+
+		void drop(std::deque<QueuedPacket>::iterator it);
+		void pop();
+
+		// state
+
+		std::deque<QueuedPacket> _queue;
+
+		size_t _maxPackets;
+		size_t _maxBytes;
+		drop_policy_t _policy;
+
+		size_t _bytes;
+
+		uint64_t _sentPackets;
+		uint64_t _droppedPackets;
+		uint64_t _droppedBytes;
+
+		// shared by all queues of the process
+
+		static size_t totalBytes;
+		static size_t budgetBytes;
+		static uint64_t totalDropped;
+};
+
+#endif /* SEND_QUEUE_H */
@@ -19,9 +19,15 @@
 #include "srtp.h"
 
 #include <map>
+#include <vector>
+#include <cstring>
+
+#include <openssl/crypto.h>
 
 #include <node_buffer.h>
 
+#include "load.h"
+#include "self_test.h"
 #include "helper.h"
 
 using namespace v8;
@@ -54,7 +60,20 @@ static std::map<err_status_t,const char*> error_map = {
 	{ err_status_pfkey_err, "pfkey_err" },
 };
 
+// not measured, a guess from the structures involved: the context with the
+// stream template and its cipher and auth states, libsrtp clones a stream per
+// ssrc and we assume one as that is what an echoed m-line usually carries
+const size_t LIBSRTP_SESSION_ESTIMATE = 1536 + 256;
+
+// the two cipher and five digest contexts of one direction, counted through
+// CRYPTO_set_mem_functions in a standalone program against OpenSSL 3.0
+const size_t EVP_SESSION_ESTIMATE = 2048;
+
+// marks exported state, the last byte is the format version
+static const uint8_t STATE_MAGIC[] = { 'S', 'R', 'T', 'P', 1 };
+
 v8::Persistent<v8::Function> Srtp::constructor;
+v8::Persistent<v8::FunctionTemplate> Srtp::constructorTemplate;
 bool Srtp::initialized = false;
 
 static void createSession(srtp_t *session, const char *key, ssrc_type_t direction) {
@@ -78,7 +97,17 @@ static void createSession(srtp_t *session, const char *key, ssrc_type_t directio
 	srtp_create(session, &policy);
 }
 
-Srtp::Srtp(const char *sendKey, const char *recvKey) {
+Srtp::Srtp(const char *sendKey, const char *recvKey, srtp_backend_t backend, bool exportable) :
+	_backend(backend), _sendSession(NULL), _recvSession(NULL), _evpSend(NULL), _evpRecv(NULL), _closed(false)
+{
+	++Load::srtpSessions;
+
+	if(backend == BACKEND_OPENSSL) {
+		_evpSend = new EvpSrtp((const uint8_t*) sendKey, exportable);
+		_evpRecv = new EvpSrtp((const uint8_t*) recvKey, exportable);
+		return;
+	}
+
 	if(!initialized) {
 		DEBUG("initializing srtp");
 		srtp_init();
@@ -89,9 +118,31 @@ Srtp::Srtp(const char *sendKey, const char *recvKey) {
 	createSession(&_recvSession, recvKey, ssrc_any_inbound);
 }
 
+Srtp::Srtp(EvpSrtp *send, EvpSrtp *recv) :
+	_backend(BACKEND_OPENSSL), _sendSession(NULL), _recvSession(NULL), _evpSend(send), _evpRecv(recv), _closed(false)
+{
+	++Load::srtpSessions;
+}
+
 Srtp::~Srtp() {
-	srtp_dealloc(_sendSession);
-	srtp_dealloc(_recvSession);
+	release();
+}
+
+void Srtp::release() {
+	if(_closed) {
+		return;
+	}
+
+	_closed = true;
+	--Load::srtpSessions;
+
+	if(_backend == BACKEND_OPENSSL) {
+		delete _evpSend;
+		delete _evpRecv;
+	} else {
+		srtp_dealloc(_sendSession);
+		srtp_dealloc(_recvSession);
+	}
 }
 
 void Srtp::init(v8::Handle<v8::Object> exports) {
@@ -104,24 +155,146 @@ void Srtp::init(v8::Handle<v8::Object> exports) {
 	NODE_SET_PROTOTYPE_METHOD(tpl, "unprotectRtp", unprotectRtp);
 	NODE_SET_PROTOTYPE_METHOD(tpl, "protectRtcp", protectRtcp);
 	NODE_SET_PROTOTYPE_METHOD(tpl, "unprotectRtcp", unprotectRtcp);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "protectRtpBatch", protectRtpBatch);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "unprotectRtpBatch", unprotectRtpBatch);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "rtcpStats", rtcpStats);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "backend", backend);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "close", close);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "exportState", exportState);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "memoryUsage", memoryUsage);
 	constructor = Persistent<Function>::New(tpl->GetFunction());
+	constructorTemplate = Persistent<FunctionTemplate>::New(tpl);
+	// static
+	constructor->Set(String::NewSymbol("selfTest"), FunctionTemplate::New(selfTest)->GetFunction());
 	// export
 	exports->Set(String::NewSymbol("Srtp"), constructor);
 }
 
+bool Srtp::HasInstance(v8::Handle<v8::Value> value) {
+	return value->IsObject() && constructorTemplate->HasInstance(value);
+}
+
+const char* Srtp::errorString(err_status_t err) {
+	auto it = error_map.find(err);
+
+	if(it != error_map.end()) {
+		return it->second;
+	} else {
+		return "unknown";
+	}
+}
+
+err_status_t Srtp::protect(void *buf, int *size, bool rtcp) {
+	SrtpPacket packet = { (uint8_t*) buf, *size, err_status_ok };
+
+	process(rtcp ? PROTECT_RTCP : PROTECT_RTP, &packet, 1);
+
+	*size = packet.size;
+
+	return packet.err;
+}
+
+void Srtp::process(srtp_op_t op, SrtpPacket *packets, size_t count) {
+	if(_closed) {
+		for(size_t i = 0; i < count; ++i) {
+			packets[i].err = err_status_no_ctx;
+		}
+
+		return;
+	}
+
+	Load::srtpPackets += count;
+
+	if(_backend == BACKEND_OPENSSL) {
+		switch(op) {
+			case PROTECT_RTP:
+				_evpSend->protectRtp(packets, count);
+				break;
+			case UNPROTECT_RTP:
+				_evpRecv->unprotectRtp(packets, count);
+				break;
+			case PROTECT_RTCP:
+				_evpSend->protectRtcp(packets, count);
+				break;
+			case UNPROTECT_RTCP:
+				_evpRecv->unprotectRtcp(packets, count);
+				break;
+		}
+
+		return;
+	}
+
+	// libsrtp has no batch interface
+
+	for(size_t i = 0; i < count; ++i) {
+		SrtpPacket& packet = packets[i];
+
+		switch(op) {
+			case PROTECT_RTP:
+				packet.err = srtp_protect(_sendSession, packet.data, &packet.size);
+				break;
+			case UNPROTECT_RTP:
+				packet.err = srtp_unprotect(_recvSession, packet.data, &packet.size);
+				break;
+			case PROTECT_RTCP:
+				packet.err = srtp_protect_rtcp(_sendSession, packet.data, &packet.size);
+				break;
+			case UNPROTECT_RTCP:
+				packet.err = srtp_unprotect_rtcp(_recvSession, packet.data, &packet.size);
+				break;
+		}
+	}
+}
+
 v8::Handle<v8::Value> Srtp::New(const v8::Arguments& args) {
 	HandleScope scope;
 
 	if (args.IsConstructCall()) {
 		// Invoked as constructor: `new MyObject(...)`
+		if(node::Buffer::HasInstance(args[0]) && args[1]->IsUndefined()) {
+			// state exported by another process
+			Srtp* obj = restore((const uint8_t*) node::Buffer::Data(args[0]), node::Buffer::Length(args[0]));
+
+			if(!obj) {
+				return ThrowException(Exception::TypeError(String::New("Invalid srtp state")));
+			}
+
+			obj->Wrap(args.This());
+
+			return args.This();
+		}
+
 		if(!node::Buffer::HasInstance(args[0]) || !node::Buffer::HasInstance(args[1])) {
 			return ThrowException(Exception::TypeError(String::New("Expected buffers")));
 		}
 
+		if(node::Buffer::Length(args[0]) < SRTP_MASTER_LEN || node::Buffer::Length(args[1]) < SRTP_MASTER_LEN) {
+			return ThrowException(Exception::TypeError(String::New("Keys too short")));
+		}
+
 		const char *sendKey = node::Buffer::Data(args[0]);
 		const char *recvKey = node::Buffer::Data(args[1]);
 
-		Srtp* obj = new Srtp(sendKey, recvKey);
+		srtp_backend_t backend = BACKEND_LIBSRTP;
+
+		if(args[2]->IsString()) {
+			String::Utf8Value name(args[2]);
+
+			if(strcmp(*name, "openssl") == 0) {
+				backend = BACKEND_OPENSSL;
+			} else if(strcmp(*name, "libsrtp") != 0) {
+				return ThrowException(Exception::TypeError(String::New("Unknown srtp backend")));
+			}
+		}
+
+		// libsrtp keeps its state in opaque structures
+		bool exportable = args[3]->BooleanValue();
+
+		if(exportable && backend != BACKEND_OPENSSL) {
+			return ThrowException(Exception::TypeError(String::New("Exporting requires the openssl backend")));
+		}
+
+		Srtp* obj = new Srtp(sendKey, recvKey, backend, exportable);
 		obj->Wrap(args.This());
 
 		return args.This();
@@ -133,9 +306,29 @@ v8::Handle<v8::Value> Srtp::New(const v8::Arguments& args) {
 	}
 }
 
-v8::Handle<v8::Value> Srtp::convert(const v8::Arguments& args, srtp_t session, convert_fun fun) {
+static Handle<Value> slice(Handle<Object> buffer, int size) {
+	Handle<Value> slice_v = buffer->Get(String::New("slice"));
+
+	if(!slice_v->IsFunction()) {
+		return ThrowException(String::New("v8_error"));
+	}
+
+	Handle<v8::Function> slice_f = v8::Handle<v8::Function>::Cast(slice_v);
+
+	const int argc = 2;
+	Handle<Value> argv[argc] = {
+		Integer::New(0),
+		Integer::New(size),
+	};
+
+	return slice_f->Call(buffer, argc, argv);
+}
+
+v8::Handle<v8::Value> Srtp::convert(const v8::Arguments& args, srtp_op_t op) {
 	HandleScope scope;
 
+	Srtp *srtp = node::ObjectWrap::Unwrap<Srtp>(args.This()->ToObject());
+
 	// type checking
 
 	if(!node::Buffer::HasInstance(args[0])) {
@@ -147,70 +340,438 @@ v8::Handle<v8::Value> Srtp::convert(const v8::Arguments& args, srtp_t session, c
 	int size = node::Buffer::Length(args[0]);
 	char *in_buf = node::Buffer::Data(args[0]);
 
-	Handle<Object> tmp = node::Buffer::New(size + 32)->handle_;
+	Handle<Object> tmp = node::Buffer::New(size + SRTP_MAX_TRAILER_LEN)->handle_;
 	char *out_buf = node::Buffer::Data(tmp);
 
 	memcpy(out_buf, in_buf, size);
 
 	// actual crypt stuff
 
-	err_status_t err = fun(session, out_buf, &size);
+	SrtpPacket packet = { (uint8_t*) out_buf, size, err_status_ok };
 
-	if(err != err_status_ok) {
-		const char *err_str;
-		auto it = error_map.find(err);
+	srtp->process(op, &packet, 1);
 
-		if(it != error_map.end()) {
-			err_str = it->second;
-		} else {
-			err_str = "unknown";
-		}
+	if(packet.err != err_status_ok) {
+		return ThrowException(String::New(errorString(packet.err)));
+	}
+
+	// learn from decrypted rtcp on the way through
 
-		return ThrowException(String::New(err_str));
+	if(op == UNPROTECT_RTCP) {
+		srtp->_rtcpStats.feed(packet.data, packet.size, uv_now(uv_default_loop()));
 	}
 
 	// return slice of the right size
 
-	Handle<Value> slice_v = tmp->Get(String::New("slice")); 
+	return scope.Close(slice(tmp, packet.size));
+}
 
-	if(!slice_v->IsFunction()) {
-		return ThrowException(String::New("v8_error"));
+v8::Handle<v8::Value> Srtp::convertBatch(const v8::Arguments& args, srtp_op_t op) {
+	HandleScope scope;
+
+	Srtp *srtp = node::ObjectWrap::Unwrap<Srtp>(args.This()->ToObject());
+
+	if(!args[0]->IsArray()) {
+		return ThrowException(Exception::TypeError(String::New("Expected array of buffers")));
 	}
 
-	Handle<v8::Function> slice_f = v8::Handle<v8::Function>::Cast(slice_v);
+	Local<Array> list = Local<Array>::Cast(args[0]);
+	uint32_t count = list->Length();
 
-	const int argc = 2;
-	Handle<Value> argv[argc] = {
-		Integer::New(0),
-		Integer::New(size),
-	};
+	std::vector<SrtpPacket> packets(count);
+	std::vector<Handle<Object> > buffers(count);
+
+	// copy everything so the backend gets the whole batch at once
+
+	for(uint32_t i = 0; i < count; ++i) {
+		Local<Value> entry = list->Get(i);
+
+		if(!node::Buffer::HasInstance(entry)) {
+			return ThrowException(Exception::TypeError(String::New("Expected array of buffers")));
+		}
+
+		int size = node::Buffer::Length(entry);
 
-	Handle<Value> res = slice_f->Call(tmp, argc, argv);
+		buffers[i] = node::Buffer::New(size + SRTP_MAX_TRAILER_LEN)->handle_;
+
+		packets[i].data = (uint8_t*) node::Buffer::Data(buffers[i]);
+		packets[i].size = size;
+		packets[i].err = err_status_ok;
+
+		memcpy(packets[i].data, node::Buffer::Data(entry), size);
+	}
+
+	srtp->process(op, packets.data(), count);
+
+	// failed packets are null instead of throwing away the whole batch
+
+	Local<Array> res = Array::New(count);
+
+	for(uint32_t i = 0; i < count; ++i) {
+		if(packets[i].err == err_status_ok) {
+			res->Set(i, slice(buffers[i], packets[i].size));
+		} else {
+			res->Set(i, Null());
+		}
+	}
 
 	return scope.Close(res);
 }
 
 v8::Handle<v8::Value> Srtp::protectRtp(const v8::Arguments& args) {
+	return convert(args, PROTECT_RTP);
+}
+
+v8::Handle<v8::Value> Srtp::unprotectRtp(const v8::Arguments& args) {
+	return convert(args, UNPROTECT_RTP);
+}
+
+v8::Handle<v8::Value> Srtp::protectRtcp(const v8::Arguments& args) {
+	return convert(args, PROTECT_RTCP);
+}
+
+v8::Handle<v8::Value> Srtp::unprotectRtcp(const v8::Arguments& args) {
+	return convert(args, UNPROTECT_RTCP);
+}
+
+v8::Handle<v8::Value> Srtp::protectRtpBatch(const v8::Arguments& args) {
+	return convertBatch(args, PROTECT_RTP);
+}
+
+v8::Handle<v8::Value> Srtp::unprotectRtpBatch(const v8::Arguments& args) {
+	return convertBatch(args, UNPROTECT_RTP);
+}
+
+v8::Handle<v8::Value> Srtp::close(const v8::Arguments& args) {
+	HandleScope scope;
+
 	Srtp *srtp = node::ObjectWrap::Unwrap<Srtp>(args.This()->ToObject());
 
-	return convert(args, srtp->_sendSession, srtp_protect);
+	// free the sessions now instead of waiting for the garbage collector
+	srtp->release();
+
+	return scope.Close(Undefined());
 }
 
-v8::Handle<v8::Value> Srtp::unprotectRtp(const v8::Arguments& args) {
+Srtp* Srtp::restore(const uint8_t *data, size_t size) {
+	if(size < sizeof(STATE_MAGIC) || memcmp(data, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) {
+		return NULL;
+	}
+
+	size_t offset = sizeof(STATE_MAGIC);
+
+	EvpSrtp *send = EvpSrtp::deserialize(data, size, offset);
+	EvpSrtp *recv = send ? EvpSrtp::deserialize(data, size, offset) : NULL;
+
+	if(!recv || offset != size) {
+		delete send;
+		delete recv;
+		return NULL;
+	}
+
+	return new Srtp(send, recv);
+}
+
+v8::Handle<v8::Value> Srtp::exportState(const v8::Arguments& args) {
+	HandleScope scope;
+
 	Srtp *srtp = node::ObjectWrap::Unwrap<Srtp>(args.This()->ToObject());
 
-	return convert(args, srtp->_recvSession, srtp_unprotect);
+	// libsrtp keeps its state in opaque structures
+	if(srtp->_backend != BACKEND_OPENSSL) {
+		return ThrowException(String::New("Exporting requires the openssl backend"));
+	}
+
+	if(srtp->_closed) {
+		return ThrowException(String::New("Session is closed"));
+	}
+
+	if(!srtp->_evpSend->exportable()) {
+		return ThrowException(String::New("Session was not created exportable"));
+	}
+
+	std::vector<uint8_t> state(STATE_MAGIC, STATE_MAGIC + sizeof(STATE_MAGIC));
+
+	srtp->_evpSend->serialize(state);
+	srtp->_evpRecv->serialize(state);
+
+	Local<Object> res = node::Buffer::New((const char*) state.data(), state.size())->handle_;
+
+	OPENSSL_cleanse(state.data(), state.size());
+
+	return scope.Close(res);
 }
 
-v8::Handle<v8::Value> Srtp::protectRtcp(const v8::Arguments& args) {
+v8::Handle<v8::Value> Srtp::memoryUsage(const v8::Arguments& args) {
+	HandleScope scope;
+
 	Srtp *srtp = node::ObjectWrap::Unwrap<Srtp>(args.This()->ToObject());
 
-	return convert(args, srtp->_sendSession, srtp_protect_rtcp);
+	size_t crypto = 0;
+
+	if(srtp->_closed) {
+		// nothing left but the wrapper
+	} else if(srtp->_backend == BACKEND_OPENSSL) {
+		crypto = srtp->_evpSend->memoryUsage() + srtp->_evpRecv->memoryUsage();
+		crypto += 2 * EVP_SESSION_ESTIMATE;
+	} else {
+		crypto = 2 * LIBSRTP_SESSION_ESTIMATE;
+	}
+
+	size_t rtcp = srtp->_rtcpStats.sources().size() * (sizeof(RtcpSourceStats) + 4 * sizeof(void*));
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("crypto"), Number::New(crypto));
+	res->Set(String::New("rtcp"), Number::New(rtcp));
+	res->Set(String::New("estimate"), Number::New(crypto + rtcp));
+
+	return scope.Close(res);
 }
 
-v8::Handle<v8::Value> Srtp::unprotectRtcp(const v8::Arguments& args) {
+v8::Handle<v8::Value> Srtp::backend(const v8::Arguments& args) {
+	HandleScope scope;
+
 	Srtp *srtp = node::ObjectWrap::Unwrap<Srtp>(args.This()->ToObject());
 
-	return convert(args, srtp->_recvSession, srtp_unprotect_rtcp);
+	return scope.Close(String::New(srtp->_backend == BACKEND_OPENSSL ? "openssl" : "libsrtp"));
+}
+
+v8::Handle<v8::Value> Srtp::rtcpStats(const v8::Arguments& args) {
+	HandleScope scope;
+
+	Srtp *srtp = node::ObjectWrap::Unwrap<Srtp>(args.This()->ToObject());
+
+	const RtcpStats& stats = srtp->_rtcpStats;
+	const std::map<uint32_t,RtcpSourceStats>& sources = stats.sources();
+
+	uint64_t now = uv_now(uv_default_loop());
+
+	Local<Array> list = Array::New(sources.size());
+	uint32_t index = 0;
+
+	for(auto it = sources.begin(); it != sources.end(); ++it, ++index) {
+		const RtcpSourceStats& source = it->second;
+		Local<Object> entry = Object::New();
+
+		double elapsed = (now - source.firstSeen) / 1000.0;
+
+		entry->Set(String::New("ssrc"), Number::New(it->first));
+		entry->Set(String::New("senderReports"), Number::New(source.senderReports));
+		entry->Set(String::New("receiverReports"), Number::New(source.receiverReports));
+		entry->Set(String::New("byes"), Number::New(source.byes));
+		entry->Set(String::New("nacks"), Number::New(source.nacks));
+		entry->Set(String::New("nackedPackets"), Number::New(source.nackedPackets));
+		entry->Set(String::New("plis"), Number::New(source.plis));
+		entry->Set(String::New("firs"), Number::New(source.firs));
+
+		// per second since we first saw the source
+		entry->Set(String::New("nackRate"), Number::New(elapsed > 0 ? source.nacks / elapsed : 0));
+		entry->Set(String::New("pliRate"), Number::New(elapsed > 0 ? source.plis / elapsed : 0));
+
+		if(source.hasReport) {
+			entry->Set(String::New("fractionLost"), Number::New(source.fractionLost / 256.0));
+			entry->Set(String::New("cumulativeLost"), Integer::New(source.cumulativeLost));
+			entry->Set(String::New("jitter"), Number::New(source.jitter));
+		}
+
+		if(source.rttSamples) {
+			entry->Set(String::New("rtt"), Number::New(source.rtt));
+			entry->Set(String::New("minRtt"), Number::New(source.minRtt));
+		}
+
+		list->Set(index, entry);
+	}
+
+	Local<Object> res = Object::New();
+
+	res->Set(String::New("packets"), Number::New(stats.packets()));
+	res->Set(String::New("malformed"), Number::New(stats.malformed()));
+	res->Set(String::New("sources"), list);
+
+	return scope.Close(res);
+}
+
+
+// self test
+
+// RFC 3711 appendix B.3, also used by the libsrtp test vectors
+static const uint8_t TEST_MASTER[SRTP_MASTER_LEN] = {
+	0xe1, 0xf9, 0x7a, 0x0d, 0x3e, 0x01, 0x8b, 0xe0, 0xd6, 0x4f, 0xa3, 0x2c, 0x06, 0xde, 0x41, 0x39,
+	0x0e, 0xc6, 0x75, 0xad, 0x49, 0x8a, 0xfe, 0xeb, 0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6,
+};
+
+static const uint8_t TEST_CIPHER_KEY[] = {
+	0xc6, 0x1e, 0x7a, 0x93, 0x74, 0x4f, 0x39, 0xee, 0x10, 0x73, 0x4a, 0xfe, 0x3f, 0xf7, 0xa0, 0x87,
+};
+
+static const uint8_t TEST_CIPHER_SALT[] = {
+	0x30, 0xcb, 0xbc, 0x08, 0x86, 0x3d, 0x8c, 0x85, 0xd4, 0x9d, 0xb3, 0x4a, 0x9a, 0xe1,
+};
+
+static const uint8_t TEST_AUTH_KEY[] = {
+	0xce, 0xbe, 0x32, 0x1f, 0x6f, 0xf7, 0x71, 0x6b, 0x6f, 0xd4, 0xab, 0x49, 0xaf, 0x25, 0x6a, 0x15,
+	0x6d, 0x38, 0xba, 0xa4,
+};
+
+// libsrtp srtp_validate()
+static const uint8_t TEST_RTP_PLAIN[] = {
+	0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad, 0xca, 0xfe, 0xba, 0xbe,
+	0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+};
+
+static const uint8_t TEST_RTP_CIPHER[] = {
+	0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad, 0xca, 0xfe, 0xba, 0xbe,
+	0x4e, 0x55, 0xdc, 0x4c, 0xe7, 0x99, 0x78, 0xd8, 0x8c, 0xa4, 0xd2, 0x15, 0x94, 0x9d, 0x24, 0x02,
+	0xb7, 0x8d, 0x6a, 0xcc, 0x99, 0xea, 0x17, 0x9b, 0x8d, 0xbb,
+};
+
+// libsrtp srtp_validate(), sender report with E flag and index 1 appended
+static const uint8_t TEST_RTCP_PLAIN[] = {
+	0x81, 0xc8, 0x00, 0x0b, 0xca, 0xfe, 0xba, 0xbe,
+	0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+};
+
+static const uint8_t TEST_RTCP_CIPHER[] = {
+	0x81, 0xc8, 0x00, 0x0b, 0xca, 0xfe, 0xba, 0xbe,
+	0x71, 0x28, 0x03, 0x5b, 0xe4, 0x87, 0xb9, 0xbd, 0xbe, 0xf8, 0x90, 0x41, 0xf9, 0x77, 0xa5, 0xa8,
+	0x80, 0x00, 0x00, 0x01, 0x99, 0x3e, 0x08, 0xcd, 0x54, 0xd6, 0xc1, 0x23, 0x07, 0x98,
+};
+
+static bool testDerivation() {
+	uint8_t out[EVP_SRTP_AUTH_KEY_LEN];
+
+	const uint8_t *master_key = TEST_MASTER;
+	const uint8_t *master_salt = TEST_MASTER + EVP_SRTP_KEY_LEN;
+
+	EvpSrtp::deriveKey(master_key, master_salt, 0, out, sizeof(TEST_CIPHER_KEY));
+
+	if(memcmp(out, TEST_CIPHER_KEY, sizeof(TEST_CIPHER_KEY)) != 0) {
+		return false;
+	}
+
+	EvpSrtp::deriveKey(master_key, master_salt, 1, out, sizeof(TEST_AUTH_KEY));
+
+	if(memcmp(out, TEST_AUTH_KEY, sizeof(TEST_AUTH_KEY)) != 0) {
+		return false;
+	}
+
+	EvpSrtp::deriveKey(master_key, master_salt, 2, out, sizeof(TEST_CIPHER_SALT));
+
+	return memcmp(out, TEST_CIPHER_SALT, sizeof(TEST_CIPHER_SALT)) == 0;
+}
+
+static bool testVector(srtp_backend_t backend) {
+	Srtp srtp((const char*) TEST_MASTER, (const char*) TEST_MASTER, backend);
+
+	uint8_t buf[sizeof(TEST_RTP_CIPHER) + SRTP_MAX_TRAILER_LEN];
+	memcpy(buf, TEST_RTP_PLAIN, sizeof(TEST_RTP_PLAIN));
+
+	SrtpPacket packet = { buf, sizeof(TEST_RTP_PLAIN), err_status_ok };
+
+	srtp.process(PROTECT_RTP, &packet, 1);
+
+	if(packet.err != err_status_ok || packet.size != sizeof(TEST_RTP_CIPHER) || memcmp(buf, TEST_RTP_CIPHER, packet.size) != 0) {
+		return false;
+	}
+
+	srtp.process(UNPROTECT_RTP, &packet, 1);
+
+	return packet.err == err_status_ok && packet.size == sizeof(TEST_RTP_PLAIN) && memcmp(buf, TEST_RTP_PLAIN, packet.size) == 0;
 }
 
+static bool testRtcpVector(srtp_backend_t backend) {
+	Srtp srtp((const char*) TEST_MASTER, (const char*) TEST_MASTER, backend);
+
+	uint8_t buf[sizeof(TEST_RTCP_CIPHER) + SRTP_MAX_TRAILER_LEN];
+	memcpy(buf, TEST_RTCP_PLAIN, sizeof(TEST_RTCP_PLAIN));
+
+	SrtpPacket packet = { buf, sizeof(TEST_RTCP_PLAIN), err_status_ok };
+
+	srtp.process(PROTECT_RTCP, &packet, 1);
+
+	if(packet.err != err_status_ok || packet.size != sizeof(TEST_RTCP_CIPHER) || memcmp(buf, TEST_RTCP_CIPHER, packet.size) != 0) {
+		return false;
+	}
+
+	srtp.process(UNPROTECT_RTCP, &packet, 1);
+
+	return packet.err == err_status_ok && packet.size == sizeof(TEST_RTCP_PLAIN) && memcmp(buf, TEST_RTCP_PLAIN, packet.size) == 0;
+}
+
+static bool testCross(Srtp& from, Srtp& to, bool rtcp, uint32_t ssrc) {
+	// a few packets including a sequence number wrap on the rtp side
+
+	for(int i = 0; i < 4; ++i) {
+		uint8_t plain[64];
+		uint8_t buf[sizeof(plain) + SRTP_MAX_TRAILER_LEN];
+
+		uint16_t seq = 0xfffe + i;
+
+		for(size_t j = 0; j < sizeof(plain); ++j) {
+			plain[j] = j * 7 + i;
+		}
+
+		if(rtcp) {
+			// receiver report with padding as payload
+			plain[0] = 0x80;
+			plain[1] = 201;
+			plain[2] = 0;
+			plain[3] = sizeof(plain) / 4 - 1;
+			plain[4] = ssrc >> 24;
+			plain[5] = ssrc >> 16;
+			plain[6] = ssrc >> 8;
+			plain[7] = ssrc;
+		} else {
+			plain[0] = 0x80;
+			plain[1] = 0x60;
+			plain[2] = seq >> 8;
+			plain[3] = seq;
+			plain[8] = ssrc >> 24;
+			plain[9] = ssrc >> 16;
+			plain[10] = ssrc >> 8;
+			plain[11] = ssrc;
+		}
+
+		memcpy(buf, plain, sizeof(plain));
+
+		SrtpPacket packet = { buf, sizeof(plain), err_status_ok };
+
+		from.process(rtcp ? PROTECT_RTCP : PROTECT_RTP, &packet, 1);
+
+		if(packet.err != err_status_ok) {
+			return false;
+		}
+
+		to.process(rtcp ? UNPROTECT_RTCP : UNPROTECT_RTP, &packet, 1);
+
+		if(packet.err != err_status_ok || packet.size != sizeof(plain) || memcmp(buf, plain, sizeof(plain)) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+v8::Handle<v8::Value> Srtp::selfTest(const v8::Arguments& args) {
+	HandleScope scope;
+
+	const char *key = (const char*) TEST_MASTER;
+
+	Srtp libsrtp(key, key, BACKEND_LIBSRTP);
+	Srtp openssl(key, key, BACKEND_OPENSSL);
+
+	test_results_t results;
+
+	results.push_back(std::make_pair("key derivation", testDerivation()));
+	results.push_back(std::make_pair("libsrtp test vector", testVector(BACKEND_LIBSRTP)));
+	results.push_back(std::make_pair("openssl test vector", testVector(BACKEND_OPENSSL)));
+	results.push_back(std::make_pair("libsrtp rtcp test vector", testRtcpVector(BACKEND_LIBSRTP)));
+	results.push_back(std::make_pair("openssl rtcp test vector", testRtcpVector(BACKEND_OPENSSL)));
+	results.push_back(std::make_pair("libsrtp to openssl rtp", testCross(libsrtp, openssl, false, 0x11111111)));
+	results.push_back(std::make_pair("openssl to libsrtp rtp", testCross(openssl, libsrtp, false, 0x22222222)));
+	results.push_back(std::make_pair("libsrtp to openssl rtcp", testCross(libsrtp, openssl, true, 0x33333333)));
+	results.push_back(std::make_pair("openssl to libsrtp rtcp", testCross(openssl, libsrtp, true, 0x44444444)));
+
+	return scope.Close(testResultsToObject(results));
+}
@@ -24,17 +24,47 @@
 
 #include <srtp/srtp.h>
 
-typedef err_status_t (*convert_fun)(srtp_t, void* buf, int* len);
+#include "rtcp.h"
+#include "evp_srtp.h"
+
+// master key followed by master salt
+const size_t SRTP_MASTER_LEN = EVP_SRTP_KEY_LEN + EVP_SRTP_SALT_LEN;
+
+// room we need behind a packet for the tag and the SRTCP index
+const int SRTP_MAX_TRAILER_LEN = 32;
+
+enum srtp_backend_t {
+	BACKEND_LIBSRTP,
+	BACKEND_OPENSSL,
+};
+
+enum srtp_op_t {
+	PROTECT_RTP,
+	UNPROTECT_RTP,
+	PROTECT_RTCP,
+	UNPROTECT_RTCP,
+};
 
 class Srtp : public node::ObjectWrap {
 	public:
-		Srtp(const char *sendKey, const char *recvKey);
+		Srtp(const char *sendKey, const char *recvKey, srtp_backend_t backend, bool exportable = false);
+		// restored from an exported state, takes ownership of both
+		Srtp(EvpSrtp *send, EvpSrtp *recv);
 		~Srtp();
 
 		static void init(v8::Handle<v8::Object> exports);
 
+		static bool HasInstance(v8::Handle<v8::Value> value);
+
+		static const char* errorString(err_status_t err);
+
+		// for native code sending packets on our behalf
+		err_status_t protect(void *buf, int *size, bool rtcp);
+		void process(srtp_op_t op, SrtpPacket *packets, size_t count);
+
 	private:
 		static v8::Persistent<v8::Function> constructor;
+		static v8::Persistent<v8::FunctionTemplate> constructorTemplate;
 
 		// js functions
 
@@ -43,16 +73,39 @@ class Srtp : public node::ObjectWrap {
 		static v8::Handle<v8::Value> unprotectRtp(const v8::Arguments& args);
 		static v8::Handle<v8::Value> protectRtcp(const v8::Arguments& args);
 		static v8::Handle<v8::Value> unprotectRtcp(const v8::Arguments& args);
+		static v8::Handle<v8::Value> protectRtpBatch(const v8::Arguments& args);
+		static v8::Handle<v8::Value> unprotectRtpBatch(const v8::Arguments& args);
+		static v8::Handle<v8::Value> rtcpStats(const v8::Arguments& args);
+		static v8::Handle<v8::Value> backend(const v8::Arguments& args);
+		static v8::Handle<v8::Value> close(const v8::Arguments& args);
+		static v8::Handle<v8::Value> exportState(const v8::Arguments& args);
+		static v8::Handle<v8::Value> memoryUsage(const v8::Arguments& args);
+
+		static v8::Handle<v8::Value> selfTest(const v8::Arguments& args);
 
 		// helper
 
-		static v8::Handle<v8::Value> convert(const v8::Arguments& args, srtp_t session, convert_fun fun);
+		void release();
+
+		static Srtp* restore(const uint8_t *data, size_t size);
+
+		static v8::Handle<v8::Value> convert(const v8::Arguments& args, srtp_op_t op);
+		static v8::Handle<v8::Value> convertBatch(const v8::Arguments& args, srtp_op_t op);
 
 		// state
 
+		srtp_backend_t _backend;
+
 		srtp_t _sendSession;
 		srtp_t _recvSession;
 
+		EvpSrtp *_evpSend;
+		EvpSrtp *_evpRecv;
+
+		RtcpStats _rtcpStats;
+
+		bool _closed;
+
 		static bool initialized;
 };
 
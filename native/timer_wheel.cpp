@@ -0,0 +1,283 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timer_wheel.h"
+
+#include "helper.h"
+
+const uint64_t TICK_MS = 2;
+
+const int L0_BITS = 8;
+const int L1_BITS = 6;
+const int L2_BITS = 6;
+
+const uint64_t L0_MASK = (1 << L0_BITS) - 1;
+const uint64_t L1_MASK = (1 << L1_BITS) - 1;
+const uint64_t L2_MASK = (1 << L2_BITS) - 1;
+
+const uint64_t MAX_DELTA = (1ull << (L0_BITS + L1_BITS + L2_BITS)) - 1;
+
+// list handling
+
+void TimerList::push(TimerEntry *entry) {
+	entry->list = this;
+	entry->next = NULL;
+	entry->prev = tail;
+
+	if(tail) {
+		tail->next = entry;
+	} else {
+		head = entry;
+	}
+
+	tail = entry;
+}
+
+void TimerList::remove(TimerEntry *entry) {
+	if(entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		head = entry->next;
+	}
+
+	if(entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+	entry->list = NULL;
+}
+
+TimerEntry* TimerList::pop() {
+	TimerEntry *entry = head;
+
+	if(entry) {
+		remove(entry);
+	}
+
+	return entry;
+}
+
+void TimerList::take(TimerList& other) {
+	while(TimerEntry *entry = other.pop()) {
+		push(entry);
+	}
+}
+
+// instantiation
+
+TimerWheel& TimerWheel::instance() {
+	static TimerWheel wheel(uv_default_loop());
+	return wheel;
+}
+
+TimerWheel::TimerWheel(uv_loop_t *loop) : _loop(loop), _running(false), _now(0), _tick(0), _count(0) {
+	if(_loop) {
+		uv_timer_init(_loop, &_timer);
+		_timer.data = this;
+	}
+}
+
+// do stuff
+
+void TimerWheel::add(TimerEntry *entry, uint64_t delay_ms) {
+	if(entry->list) {
+		remove(entry);
+	}
+
+	if(!_running) {
+		// the wheel stood still, catch up with the clock first
+		_tick = now() / TICK_MS;
+		start();
+	}
+
+	uint64_t ticks = (delay_ms + TICK_MS - 1) / TICK_MS;
+
+	entry->expires = _tick + (ticks ? ticks : 1);
+
+	place(entry);
+	++_count;
+}
+
+void TimerWheel::remove(TimerEntry *entry) {
+	if(!entry->list) {
+		return;
+	}
+
+	entry->list->remove(entry);
+	--_count;
+
+	if(_count == 0) {
+		stop();
+	}
+}
+
+void TimerWheel::place(TimerEntry *entry) {
+	uint64_t expires = entry->expires;
+	uint64_t delta = expires > _tick ? expires - _tick : 0;
+
+	if(delta <= L0_MASK) {
+		_l0[expires & L0_MASK].push(entry);
+	} else if(delta < (1 << (L0_BITS + L1_BITS))) {
+		_l1[(expires >> L0_BITS) & L1_MASK].push(entry);
+	} else {
+		if(delta > MAX_DELTA) {
+			// will be placed again when cascading
+			expires = _tick + MAX_DELTA;
+		}
+
+		_l2[(expires >> (L0_BITS + L1_BITS)) & L2_MASK].push(entry);
+	}
+}
+
+void TimerWheel::cascade(TimerList& list) {
+	while(TimerEntry *entry = list.pop()) {
+		place(entry);
+	}
+}
+
+uint64_t TimerWheel::now() const {
+	return _loop ? uv_now(_loop) : _now;
+}
+
+void TimerWheel::advance(uint64_t now_ms) {
+	_now = now_ms;
+
+	uint64_t target = now_ms / TICK_MS;
+
+	while(_tick < target && _count > 0) {
+		++_tick;
+
+		uint64_t index = _tick & L0_MASK;
+
+		if(index == 0) {
+			uint64_t index1 = (_tick >> L0_BITS) & L1_MASK;
+
+			if(index1 == 0) {
+				cascade(_l2[(_tick >> (L0_BITS + L1_BITS)) & L2_MASK]);
+			}
+
+			cascade(_l1[index1]);
+		}
+
+		// callbacks might add or remove entries, so work on a list of our own
+
+		_due.take(_l0[index]);
+
+		while(TimerEntry *entry = _due.pop()) {
+			--_count;
+			entry->callback(entry);
+		}
+	}
+
+	if(_count == 0) {
+		stop();
+	}
+}
+
+void TimerWheel::onTimer(uv_timer_t *handle, int status) {
+	TimerWheel *wheel = (TimerWheel*) handle->data;
+
+	wheel->advance(uv_now(wheel->_loop));
+}
+
+void TimerWheel::start() {
+	if(_running) {
+		return;
+	}
+
+	if(_loop) {
+		DEBUG("starting timer wheel");
+		uv_timer_start(&_timer, onTimer, TICK_MS, TICK_MS);
+	}
+
+	_running = true;
+}
+
+void TimerWheel::stop() {
+	if(!_running) {
+		return;
+	}
+
+	if(_loop) {
+		DEBUG("stopping timer wheel");
+		uv_timer_stop(&_timer);
+	}
+
+	_running = false;
+}
+
+// self test
+
+static void countExpired(TimerEntry *entry) {
+	++*(int*) entry->data;
+}
+
+// an entry has to fire on the tick it is due and not a tick earlier
+bool TimerWheel::testExpiry(uint64_t start_ms, uint64_t delay_ms) {
+	TimerWheel wheel(NULL);
+	int fired = 0;
+	TimerEntry entry(countExpired, &fired);
+
+	wheel.advance(start_ms);
+	wheel.add(&entry, delay_ms);
+
+	uint64_t due = start_ms + delay_ms;
+
+	// jump close to the end in bigger steps, the wheel has to catch up anyway
+	for(uint64_t now = start_ms; now + 1000 < due; now += 1000) {
+		wheel.advance(now);
+	}
+
+	wheel.advance(due - TICK_MS);
+
+	if(fired != 0) {
+		return false;
+	}
+
+	wheel.advance(due);
+
+	return fired == 1 && wheel.size() == 0 && !wheel._running;
+}
+
+bool TimerWheel::testRemoval() {
+	TimerWheel wheel(NULL);
+	int fired_a = 0;
+	int fired_b = 0;
+	TimerEntry a(countExpired, &fired_a);
+	TimerEntry b(countExpired, &fired_b);
+
+	wheel.advance(1000);
+	wheel.add(&a, 600);
+	wheel.add(&b, 600);
+	wheel.remove(&a);
+
+	wheel.advance(2000);
+
+	return fired_a == 0 && fired_b == 1 && wheel.size() == 0;
+}
+
+void TimerWheel::selfTest(std::vector<std::pair<const char*,bool> >& results) {
+	results.push_back(std::make_pair("timer wheel level 0", testExpiry(1234, 300)));
+	results.push_back(std::make_pair("timer wheel level 1 to level 0", testExpiry(1234, 1000)));
+	results.push_back(std::make_pair("timer wheel level 2 to level 0", testExpiry(1234, 60 * 1000)));
+	results.push_back(std::make_pair("timer wheel beyond range", testExpiry(1234, 3 * 60 * 60 * 1000)));
+	results.push_back(std::make_pair("timer wheel removal", testRemoval()));
+}
@@ -0,0 +1,114 @@
+/*
+ *  webrtc-echo - A WebRTC echo server
+ *  Copyright (C) 2014  Stephan Thamm
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <stdint.h>
+
+#include <vector>
+#include <utility>
+
+#include <uv.h>
+
+struct TimerList;
+
+// intrusive entry, embed it into whatever should expire
+
+struct TimerEntry {
+	typedef void (*expire_fun)(TimerEntry *entry);
+
+	TimerEntry(expire_fun fun, void *data) : prev(NULL), next(NULL), list(NULL), expires(0), callback(fun), data(data) {}
+
+	TimerEntry *prev;
+	TimerEntry *next;
+	TimerList *list;
+
+	uint64_t expires;
+
+	expire_fun callback;
+	void *data;
+};
+
+struct TimerList {
+	TimerList() : head(NULL), tail(NULL) {}
+
+	void push(TimerEntry *entry);
+	void remove(TimerEntry *entry);
+	TimerEntry* pop();
+
+	void take(TimerList& other);
+
+	bool empty() const { return head == NULL; }
+
+	TimerEntry *head;
+	TimerEntry *tail;
+};
+
+// hierarchical timing wheel driven by a single libuv timer for the whole
+// process, the timer only runs while entries are pending
+//
+// a wheel without a loop is driven by hand through advance(), the self test
+// uses this to check the cascading without waiting for the clock
+
+class TimerWheel {
+	public:
+		static TimerWheel& instance();
+
+		void add(TimerEntry *entry, uint64_t delay_ms);
+		void remove(TimerEntry *entry);
+
+		size_t size() const { return _count; }
+
+		static void selfTest(std::vector<std::pair<const char*,bool> >& results);
+
+	private:
+		TimerWheel(uv_loop_t *loop);
+
+		static void onTimer(uv_timer_t *handle, int status);
+
+		uint64_t now() const;
+		void advance(uint64_t now_ms);
+		void place(TimerEntry *entry);
+		void cascade(TimerList& list);
+
+		void start();
+		void stop();
+
+		static bool testExpiry(uint64_t start_ms, uint64_t delay_ms);
+		static bool testRemoval();
+
+		// state
+
+		TimerList _l0[256];
+		TimerList _l1[64];
+		TimerList _l2[64];
+
+		TimerList _due;
+
+		uv_loop_t *_loop;
+		uv_timer_t _timer;
+		bool _running;
+
+		uint64_t _now;
+		uint64_t _tick;
+		size_t _count;
+};
+
+#endif /* TIMER_WHEEL_H */